@@ -0,0 +1,169 @@
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+
+#define ARENA_ALIGNMENT 16
+
+// Every allocation made through the hooks is preceded by this header, heap allocations have a NULL arena
+typedef struct {
+    _Alignas(ARENA_ALIGNMENT) Arena *arena;
+    size_t size;
+} ArenaAllocation;
+
+struct ArenaBlock {
+    _Alignas(ARENA_ALIGNMENT) ArenaBlock *next;
+    size_t capacity;
+    size_t used;
+};
+
+static _Thread_local Arena *arena_current;
+
+Arena *arena_use(Arena *arena) {
+    Arena *previous = arena_current;
+    arena_current = arena;
+    return previous;
+}
+
+Arena *arena_in_use(void) {
+    return arena_current;
+}
+
+void arena_restore(Arena **previous) {
+    arena_current = *previous;
+}
+
+static size_t arena_allocation_size(size_t size) {
+    return sizeof(ArenaAllocation) + ((size + ARENA_ALIGNMENT - 1) & ~(size_t) (ARENA_ALIGNMENT - 1));
+}
+
+static char *arena_block_top(ArenaBlock *block) {
+    return (char*) (block + 1) + block->used;
+}
+
+static ArenaBlock *arena_block_new(size_t capacity) {
+    ArenaBlock *block = malloc(sizeof(ArenaBlock) + capacity);
+    block->next = NULL;
+    block->capacity = capacity;
+    block->used = 0;
+    return block;
+}
+
+static ArenaAllocation *arena_allocate(Arena *arena, size_t size) {
+    size_t needed = arena_allocation_size(size);
+    ArenaBlock *block = arena->blocks;
+    if (block == NULL || block->capacity - block->used < needed) {
+        block = arena_block_new(needed > ARENA_BLOCK_SIZE ? needed : ARENA_BLOCK_SIZE);
+        if (arena->blocks != NULL && needed > ARENA_BLOCK_SIZE / 2) {
+            // Large allocations get a block of their own behind the current one, which keeps serving the small ones
+            block->next = arena->blocks->next;
+            arena->blocks->next = block;
+        }
+        else {
+            block->next = arena->blocks;
+            arena->blocks = block;
+        }
+    }
+    ArenaAllocation *allocation = (ArenaAllocation*) arena_block_top(block);
+    block->used += needed;
+    allocation->arena = arena;
+    allocation->size = size;
+    return allocation;
+}
+
+// Returns a non-zero value if the allocation is the last one made in the current block of its arena
+static int arena_is_top(ArenaAllocation *allocation) {
+    ArenaBlock *block = allocation->arena->blocks;
+    return (char*) allocation + arena_allocation_size(allocation->size) == arena_block_top(block);
+}
+
+void arena_reset(Arena *arena) {
+    ArenaBlock *kept = NULL;
+    ArenaBlock *block = arena->blocks;
+    while (block != NULL) {
+        ArenaBlock *next = block->next;
+        if (kept == NULL && block->capacity == ARENA_BLOCK_SIZE) {
+            kept = block;
+        }
+        else {
+            free(block);
+        }
+        block = next;
+    }
+    if (kept != NULL) {
+        kept->next = NULL;
+        kept->used = 0;
+    }
+    arena->blocks = kept;
+}
+
+void arena_destroy(Arena *arena) {
+    arena_reset(arena);
+    free(arena->blocks);
+    arena->blocks = NULL;
+}
+
+void *arena_hook_malloc(size_t size) {
+    ArenaAllocation *allocation;
+    if (arena_current != NULL) {
+        allocation = arena_allocate(arena_current, size);
+    }
+    else {
+        allocation = malloc(sizeof(ArenaAllocation) + size);
+        if (allocation == NULL) {
+            return NULL;
+        }
+        allocation->arena = NULL;
+        allocation->size = size;
+    }
+    return allocation + 1;
+}
+
+void *arena_hook_calloc(size_t count, size_t size) {
+    void *ptr = arena_hook_malloc(count * size);
+    if (ptr != NULL) {
+        memset(ptr, 0, count * size);
+    }
+    return ptr;
+}
+
+void *arena_hook_realloc(void *ptr, size_t size) {
+    if (ptr == NULL) {
+        return arena_hook_malloc(size);
+    }
+    ArenaAllocation *allocation = (ArenaAllocation*) ptr - 1;
+    Arena *arena = allocation->arena;
+    if (arena == NULL) {
+        allocation = realloc(allocation, sizeof(ArenaAllocation) + size);
+        if (allocation == NULL) {
+            return NULL;
+        }
+        allocation->size = size;
+        return allocation + 1;
+    }
+    // A vector growing while nothing else was allocated after it is extended in place
+    if (arena_is_top(allocation)) {
+        ArenaBlock *block = arena->blocks;
+        size_t used = block->used - arena_allocation_size(allocation->size);
+        if (block->capacity - used >= arena_allocation_size(size)) {
+            block->used = used + arena_allocation_size(size);
+            allocation->size = size;
+            return ptr;
+        }
+    }
+    ArenaAllocation *moved = arena_allocate(arena, size);
+    memcpy(moved + 1, ptr, allocation->size < size ? allocation->size : size);
+    return moved + 1;
+}
+
+void arena_hook_free(void *ptr) {
+    if (ptr == NULL) {
+        return;
+    }
+    ArenaAllocation *allocation = (ArenaAllocation*) ptr - 1;
+    if (allocation->arena == NULL) {
+        free(allocation);
+    }
+    else if (arena_is_top(allocation)) {
+        allocation->arena->blocks->used -= arena_allocation_size(allocation->size);
+    }
+}
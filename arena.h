@@ -0,0 +1,49 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include <assert.h>
+
+#define ARENA_BLOCK_SIZE (8 * 1024)
+
+typedef struct ArenaBlock ArenaBlock;
+
+// Bump allocator whose memory is released all at once. A zeroed Arena is empty and ready to use.
+typedef struct {
+    ArenaBlock *blocks;
+} Arena;
+
+// While a connection handles a request its arena is in use, and every vector and hashmap allocation of the thread
+// comes from it until the request ends. Memory that outlives the request (the file cache, the sniffed MIME types,
+// any other shared cache or global) must come from the heap instead: modules owning such memory open an
+// ARENA_HEAP_SCOPE in the functions requests call, and check it with arena_assert_heap where they allocate.
+
+// Sends the allocations the calling thread makes through the hooks below to arena, or to the heap when it is NULL.
+// Returns the arena that was in use before, so it can be restored.
+Arena *arena_use(Arena *arena);
+
+// Returns the arena in use by the calling thread, NULL for the heap
+Arena *arena_in_use(void);
+
+void arena_restore(Arena **previous);
+
+// Sends the allocations made until the end of the enclosing block to the heap, then restores the previous arena
+#define ARENA_HEAP_SCOPE Arena *arena_heap_scope_ __attribute__((cleanup(arena_restore))) = arena_use(NULL)
+
+// Aborts debug builds when memory meant to outlive the request would come from an arena
+#define arena_assert_heap() assert(arena_in_use() == NULL && "long-lived memory allocated from a request arena")
+
+// Releases everything allocated from the arena, keeping one block for the next allocations
+void arena_reset(Arena *arena);
+
+void arena_destroy(Arena *arena);
+
+// Allocator hooks for bfutils_vector.h and bfutils_hash.h.
+// Reallocated memory stays where it was allocated, and freeing arena memory only gives it back when it was the
+// last allocation, so vectors are freed as usual and the rest is reclaimed by arena_reset.
+void *arena_hook_malloc(size_t size);
+void *arena_hook_calloc(size_t count, size_t size);
+void *arena_hook_realloc(void *ptr, size_t size);
+void arena_hook_free(void *ptr);
+
+#endif //ARENA_H
@@ -169,11 +169,12 @@ void bfutils_add_shared_library_fn(BFUtilsBuildCfg cfg, char *file, int line) {
     int objs_len = 0;
     for (int i = 0; i < cfg.files_len; i++) {
         char *file = basename(cfg.files[i]);
+        char *obj = bfutils_get_file_object(file);
+        objs[objs_len++] = obj;
+        // A source shared by several targets is compiled once, but linked into each of them
         if (bfutils_build_check_duplicate(file)) {
             continue;
         }
-        char *obj = bfutils_get_file_object(file);
-        objs[objs_len++] = obj;
         fprintf(bfutils_build_fp, "build target/objs/%s: cc %s\n", obj, cfg.files[i]);
         if (cfg.cflags) {
             fprintf(bfutils_build_fp, " cflags = -fPIC %s\n", cfg.cflags);
@@ -211,11 +212,12 @@ void bfutils_add_executable_fn(BFUtilsBuildCfg cfg, char *file, int line) {
     int objs_len = 0;
     for (int i = 0; i < cfg.files_len; i++) {
         char *file = basename(cfg.files[i]);
+        char *obj = bfutils_get_file_object(file);
+        objs[objs_len++] = obj;
+        // A source shared by several targets is compiled once, but linked into each of them
         if (bfutils_build_check_duplicate(file)) {
             continue;
         }
-        char *obj = bfutils_get_file_object(file);
-        objs[objs_len++] = obj;
         fprintf(bfutils_build_fp, "build target/objs/%s: cc %s\n", obj, cfg.files[i]);
         if (cfg.cflags) {
             fprintf(bfutils_build_fp, " cflags = %s\n", cfg.cflags);
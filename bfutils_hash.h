@@ -3,6 +3,10 @@
 DESCRIPTION: 
 
     This is a single-header-file library that provides a hashmap for C.
+    Elements are stored densely in insertion order, and a separate index table maps the key hashes to them.
+    Maps with up to BFUTILS_HASHMAP_SMALL_SIZE elements have no index and are searched linearly, without hashing the key.
+    The index has one control byte per slot, holding a 7 bit tag of the key hash.
+    Lookups match the tags 16 slots at a time (with SSE2 when available) and only compare keys whose tag matches.
 
 USAGE:
     
@@ -39,6 +43,7 @@ USAGE:
 
         hashmap_remove:
             TV hashmap_remove(T*, TK); Removes and returns an element from the hashmap.
+            The last inserted element is moved to the place of the removed one.
 
         hashmap_contains:
             int hashmap_contains(T*, TK); Returns a non-zero value if the hashmap contains the TK key.
@@ -63,6 +68,7 @@ USAGE:
         
         hashmap_iterator:
             HashmapIterator hashmap_iterator(T*); Returns an iterator for the hashmap.
+            Elements are visited in insertion order, unless an element was removed.
 
         hashmap_iterator_reverse:
             HashmapIterator hashmap_iterator_reverse(T*); Returns an iterator for the hashmap in reverse order.
@@ -95,6 +101,17 @@ USAGE:
             These flags needs to be set only in the file containing #define BFUTILS_HASHMAP_IMPLEMENTATION
             If you don't want to use 'stdlib.h' memory functions you can define these flags with custom functions.
 
+        #define BFUTILS_HASHMAP_SEED 0x1234
+
+            This flag needs to be set only in the file containing #define BFUTILS_HASHMAP_IMPLEMENTATION
+            Keys are hashed with a seed chosen at random when the process starts, so an attacker can't pick keys that collide.
+            Defining this flag makes the hash function use a fixed seed instead, which makes collisions and probe lengths reproducible between runs.
+
+        #define BFUTILS_HASHMAP_SMALL_SIZE 8
+
+            This flag needs to be set only in the file containing #define BFUTILS_HASHMAP_IMPLEMENTATION
+            Number of elements a map holds before an index is built for it, it must be lower than 16.
+
 LICENSE:
 
     MIT License
@@ -128,9 +145,19 @@ LICENSE:
 
 typedef struct {
     size_t insert_count;
+    // Slots in the index, 0 while the map is small enough to be searched linearly
     size_t length;
-    unsigned char *slots;
-    unsigned char *removed;
+    // Elements that fit in the allocation
+    size_t capacity;
+    // Removed slots, which still count towards the load until the next resize
+    size_t deleted;
+    // Position of the element in every used slot. The elements are kept in insertion order, right after the header.
+    // The hashes and the control bytes are in the same allocation as the index.
+    size_t *index;
+    // Hash of every element key, in element order, so a resize never hashes the keys again
+    size_t *hashes;
+    // One control byte per slot: the top 7 bits of the key hash when the slot is used, otherwise empty or deleted
+    unsigned char *ctrl;
     void (*element_free)(void*);
 } BFUtilsHashmapHeader;
 
@@ -190,8 +217,6 @@ typedef BFUtilsHashmapIterator HashmapIterator;
 #define bfutils_hashmap_header(h) ((h) ? (BFUtilsHashmapHeader *)(h) - 1 : NULL)
 #define bfutils_hashmap_insert_count(h) ((h) ? bfutils_hashmap_header((h))->insert_count : 0)
 #define bfutils_hashmap_length(h) ((h) ? bfutils_hashmap_header((h))->length : 0)
-#define bfutils_hashmap_slots(h) ((h) ? bfutils_hashmap_header((h))->slots : NULL)
-#define bfutils_hashmap_removed(h) ((h) ? bfutils_hashmap_header((h))->removed : NULL)
 #define bfutils_hashmap_push(h, k, v) { \
     (h) = bfutils_hashmap_resize((h), sizeof(*(h)), offsetof(typeof(*(h)), key), sizeof((h)->key), 0); \
     typeof((h)->key) __key = (k); \
@@ -201,7 +226,7 @@ typedef BFUtilsHashmapIterator HashmapIterator;
 }
 #define bfutils_hashmap_get(h, k) ((h)[bfutils_hashmap_get_position((h), BFUTILS_HASHMAP_ADDRESSOF(k), sizeof(*(h)), offsetof(typeof(*(h)), key), sizeof((h)->key), 0)].value)
 #define bfutils_hashmap_get_element(h, k) ((h)[bfutils_hashmap_get_position((h), BFUTILS_HASHMAP_ADDRESSOF(k), sizeof(*(h)), offsetof(typeof(*(h)), key), sizeof((h)->key), 0)])
-#define bfutils_hashmap_contains(h, k) (bfutils_hashmap_get_position((h), BFUTILS_HASHMAP_ADDRESSOF(k), sizeof(*(h)), offsetof(typeof(*(h)), key), sizeof((h)->key), 0) > 0)
+#define bfutils_hashmap_contains(h, k) (bfutils_hashmap_get_position((h), BFUTILS_HASHMAP_ADDRESSOF(k), sizeof(*(h)), offsetof(typeof(*(h)), key), sizeof((h)->key), 0) >= 0)
 #define bfutils_hashmap_remove(h, k) ((h) = bfutils_hashmap_resize((h), sizeof(*(h)), offsetof(typeof(*(h)), key), sizeof((h)->key), 0),\
     (h)[bfutils_hashmap_remove_key((h), BFUTILS_HASHMAP_ADDRESSOF(k), sizeof(*(h)), offsetof(typeof(*(h)), key), sizeof((h)->key), 0)].value)
 #define bfutils_string_hashmap_push(h, k, v) { \
@@ -213,7 +238,7 @@ typedef BFUtilsHashmapIterator HashmapIterator;
 }
 #define bfutils_string_hashmap_get(h, k) ((h)[bfutils_hashmap_get_position((h), (k), sizeof(*(h)), offsetof(typeof(*(h)), key), sizeof((h)->key), 1)].value)
 #define bfutils_string_hashmap_get_element(h, k) ((h)[bfutils_hashmap_get_position((h), (k), sizeof(*(h)), offsetof(typeof(*(h)), key), sizeof((h)->key), 1)])
-#define bfutils_string_hashmap_contains(h, k) (bfutils_hashmap_get_position((h), (k), sizeof(*(h)), offsetof(typeof(*(h)), key), sizeof((h)->key), 1) > 0)
+#define bfutils_string_hashmap_contains(h, k) (bfutils_hashmap_get_position((h), (k), sizeof(*(h)), offsetof(typeof(*(h)), key), sizeof((h)->key), 1) >= 0)
 #define bfutils_string_hashmap_remove(h, k) ((h) = bfutils_hashmap_resize((h), sizeof(*(h)), offsetof(typeof(*(h)), key), sizeof((h)->key), 1) ,\
     (h)[bfutils_hashmap_remove_key((h), (k), sizeof(*(h)), offsetof(typeof(*(h)), key), sizeof((h)->key), 1)].value)
 #define bfutils_hashmap_free(h) (bfutils_hashmap_free_f((h), sizeof(*(h))), (h) = NULL)
@@ -225,6 +250,7 @@ typedef BFUtilsHashmapIterator HashmapIterator;
 extern void *bfutils_hashmap_resize(void *hm, size_t element_size, size_t key_offset, size_t key_size, int is_string);
 extern size_t bfutils_hashmap_insert_position(void *hm, const void *key, size_t element_size, size_t key_offset, size_t key_size, int is_string);
 extern size_t bfutils_hashmap_function(const void* key, size_t key_size);
+extern size_t bfutils_hashmap_seeded_function(const void* key, size_t key_size, unsigned long long seed);
 extern long bfutils_hashmap_get_position(void *hm, const void *key, size_t element_size, size_t key_offset, size_t key_size, int is_string);
 extern long bfutils_hashmap_remove_key(void *hm, const void *key, size_t element_size, size_t key_offset, size_t key_size, int is_string);
 extern void bfutils_hashmap_free_f(void *hm, size_t element_size);
@@ -240,213 +266,438 @@ extern void *bfutils_hashmap_with_free(void (*element_free)(void*));
 #endif // HASHMAP_H
 #ifdef BFUTILS_HASHMAP_IMPLEMENTATION
 #include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/random.h>
+
+#ifdef BFUTILS_HASHMAP_SEED
+static uint64_t bfutils_hashmap_seed = BFUTILS_HASHMAP_SEED;
+#else
+static uint64_t bfutils_hashmap_seed;
+
+__attribute__((constructor))
+static void bfutils_hashmap_seed_init(void) {
+    if (getrandom(&bfutils_hashmap_seed, sizeof(bfutils_hashmap_seed), GRND_NONBLOCK) != sizeof(bfutils_hashmap_seed)) {
+        // Not as good as random, but still different on every run
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        bfutils_hashmap_seed = ((uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec) ^ (uintptr_t) &ts;
+    }
+}
+#endif //BFUTILS_HASHMAP_SEED
+
+// Control bytes of the slots that hold no element, used slots store a 7 bit tag and have the top bit clear
+#define BFUTILS_HASHMAP_EMPTY 0x80
+#define BFUTILS_HASHMAP_DELETED 0xFE
+// Slots are probed in aligned groups of 16, the smallest table has 32 slots so a group never wraps
+#define BFUTILS_HASHMAP_GROUP_SIZE 16
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#ifndef BFUTILS_HASHMAP_SMALL_SIZE
+#define BFUTILS_HASHMAP_SMALL_SIZE 8
+#endif
+#if BFUTILS_HASHMAP_SMALL_SIZE < 1 || BFUTILS_HASHMAP_SMALL_SIZE >= 16
+#error "BFUTILS_HASHMAP_SMALL_SIZE must be between 1 and 15, the smallest index holds 16 elements."
+#endif
+
+// Returns a bit mask of the slots in the group whose control byte is c
+static inline unsigned bfutils_hashmap_group_match(const unsigned char *group, unsigned char c) {
+#ifdef __SSE2__
+    __m128i bytes = _mm_loadu_si128((const __m128i*) group);
+    return (unsigned) _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8((char) c)));
+#else
+    unsigned mask = 0;
+    for (int i = 0; i < BFUTILS_HASHMAP_GROUP_SIZE; i++) {
+        mask |= (unsigned) (group[i] == c) << i;
+    }
+    return mask;
+#endif
+}
+
+// Returns a bit mask of the slots in the group that are empty or deleted
+static inline unsigned bfutils_hashmap_group_free(const unsigned char *group) {
+#ifdef __SSE2__
+    return (unsigned) _mm_movemask_epi8(_mm_loadu_si128((const __m128i*) group));
+#else
+    unsigned mask = 0;
+    for (int i = 0; i < BFUTILS_HASHMAP_GROUP_SIZE; i++) {
+        mask |= (unsigned) (group[i] >> 7) << i;
+    }
+    return mask;
+#endif
+}
+
+static inline unsigned char bfutils_hashmap_tag(size_t hash) {
+    return (unsigned char) (hash >> (sizeof(size_t) * 8 - 7));
+}
 
 void *bfutils_hashmap_with_free(void (*element_free)(void*)) {
     BFUtilsHashmapHeader *header = (BFUtilsHashmapHeader*) BFUTILS_HASHMAP_REALLOC(NULL, sizeof(BFUtilsHashmapHeader));
     header->length = 0;
+    header->capacity = 0;
     header->insert_count = 0;
+    header->deleted = 0;
     header->element_free = element_free;
-    header->slots = NULL;
-    header->removed = NULL;
+    header->index = NULL;
+    header->hashes = NULL;
+    header->ctrl = NULL;
     return (void*) (header + 1);
 }
 
-void *bfutils_hashmap_resize(void *hm, size_t element_size, size_t key_offset, size_t key_size, int is_string) {
-    int need_to_grow = bfutils_hashmap_length(hm) == 0 || bfutils_hashmap_insert_count(hm) / (double) bfutils_hashmap_length(hm) > 0.5;
-    int need_to_shrink = bfutils_hashmap_length(hm) > 32 && bfutils_hashmap_insert_count(hm) / (double) bfutils_hashmap_length(hm) < 0.25;
-    if (!need_to_grow && !need_to_shrink) {
-        return hm;
+static inline size_t bfutils_hashmap_key_hash(const void *key, size_t key_size, int is_string) {
+    return is_string ? bfutils_hashmap_function(key, strlen(key)) : bfutils_hashmap_function(key, key_size);
+}
+
+// Returns the first free slot in the probe sequence of hash
+static inline size_t bfutils_hashmap_free_slot(BFUtilsHashmapHeader *header, size_t hash) {
+    size_t mask = header->length - 1;
+    size_t group = hash & mask & ~(size_t) (BFUTILS_HASHMAP_GROUP_SIZE - 1);
+    unsigned free_slots;
+    while ((free_slots = bfutils_hashmap_group_free(header->ctrl + group)) == 0) {
+        group = (group + BFUTILS_HASHMAP_GROUP_SIZE) & mask;
+    }
+    return group + __builtin_ctz(free_slots);
+}
+
+// Returns the slot that points to entry, whose key has the given hash
+static inline size_t bfutils_hashmap_entry_slot(BFUtilsHashmapHeader *header, size_t hash, size_t entry) {
+    size_t mask = header->length - 1;
+    size_t group = hash & mask & ~(size_t) (BFUTILS_HASHMAP_GROUP_SIZE - 1);
+    unsigned char tag = bfutils_hashmap_tag(hash);
+    for (;;) {
+        for (unsigned match = bfutils_hashmap_group_match(header->ctrl + group, tag); match != 0; match &= match - 1) {
+            size_t pos = group + __builtin_ctz(match);
+            if (header->index[pos] == entry) {
+                return pos;
+            }
+        }
+        group = (group + BFUTILS_HASHMAP_GROUP_SIZE) & mask;
     }
+}
+
+void *bfutils_hashmap_resize(void *hm, size_t element_size, size_t key_offset, size_t key_size, int is_string) {
+    BFUtilsHashmapHeader *header = bfutils_hashmap_header(hm);
+    size_t count = bfutils_hashmap_insert_count(hm);
     size_t old_length = bfutils_hashmap_length(hm);
-    size_t length = bfutils_hashmap_length(hm) > 0 ? bfutils_hashmap_length(hm) * 2 : 32;
-    if (need_to_shrink) {
-        length = bfutils_hashmap_length(hm) / 2;
+    size_t length;
+    if (old_length == 0) {
+        // Small maps have no index and are searched linearly, until they outgrow BFUTILS_HASHMAP_SMALL_SIZE
+        if (header != NULL && count < header->capacity) {
+            return hm;
+        }
+        length = header != NULL && header->capacity >= BFUTILS_HASHMAP_SMALL_SIZE ? 32 : 0;
     }
-    unsigned char *slots = bfutils_hashmap_slots(hm);
-    unsigned char *removed = bfutils_hashmap_removed(hm);
-    unsigned char *old_data = NULL;
-    if (old_length > 0) {
-        old_data = (unsigned char*) BFUTILS_HASHMAP_MALLOC(element_size * old_length);
-        memcpy(old_data, hm, element_size * old_length);
+    else {
+        size_t used = count + header->deleted;
+        // The elements array holds length / 2 elements, so the table grows before an insert would overflow it
+        int need_to_grow = used >= old_length / 2;
+        int need_to_shrink = old_length > 32 && count / (double) old_length < 0.25;
+        if (!need_to_grow && !need_to_shrink) {
+            return hm;
+        }
+        length = old_length * 2;
+        if (need_to_shrink) {
+            length = old_length / 2;
+        }
+        else if (count / (double) old_length <= 0.25) {
+            // Mostly deleted slots, dropping them is enough
+            length = old_length;
+        }
     }
-    void (*element_free)(void*) = bfutils_hashmap_header(hm) != NULL ? bfutils_hashmap_header(hm)->element_free : NULL;
-    BFUtilsHashmapHeader *header = (BFUtilsHashmapHeader*) BFUTILS_HASHMAP_REALLOC(bfutils_hashmap_header(hm), sizeof(BFUtilsHashmapHeader) + (element_size * length));
-    header->slots = (unsigned char*) BFUTILS_HASHMAP_CALLOC(1, length / 8 + 1);
-    header->removed = (unsigned char*) BFUTILS_HASHMAP_CALLOC(1, length / 8 + 1);
-    header->length = length;
-    header->element_free = element_free;
-    header->insert_count = 0;
+    size_t capacity = length > 0 ? length / 2 : BFUTILS_HASHMAP_SMALL_SIZE;
+
+    // Elements are stored in insertion order, so they keep their positions and only the index is rebuilt
+    header = (BFUtilsHashmapHeader*) BFUTILS_HASHMAP_REALLOC(header, sizeof(BFUtilsHashmapHeader) + (element_size * capacity));
+    if (hm == NULL) {
+        header->length = 0;
+        header->insert_count = 0;
+        header->deleted = 0;
+        header->element_free = NULL;
+        header->index = NULL;
+        header->hashes = NULL;
+        header->ctrl = NULL;
+    }
+    header->capacity = capacity;
     hm = (void*) (header + 1);
+    if (length == 0) {
+        return hm;
+    }
 
-    if (old_length > 0) {
-        for(int i = 0; i <= old_length / 8; i++) {
-            for (int j = 0; j < 8; j++) {
-                int is_slot_occupied = slots[i] & (1 << j);
-                int is_removed = removed[i] & (1 << j);
-                if (is_slot_occupied && !is_removed) {
-                    void * key = old_data + ((i*8+j) * element_size) + key_offset;
-                    size_t pos = bfutils_hashmap_insert_position(hm, key, element_size, key_offset, key_size, is_string);
-                    void *element = (unsigned char*)hm + (pos * element_size);
-                    void *source = old_data + ((i*8+j) * element_size);
-                    memcpy(element, source, element_size);
-                }
-            }
+    size_t *old_index = header->index;
+    size_t *old_hashes = header->hashes;
+    header->index = (size_t*) BFUTILS_HASHMAP_MALLOC(length * sizeof(size_t) + capacity * sizeof(size_t) + length);
+    header->hashes = header->index + length;
+    header->ctrl = (unsigned char*) (header->hashes + capacity);
+    memset(header->ctrl, BFUTILS_HASHMAP_EMPTY, length);
+    header->length = length;
+    header->deleted = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        // Keys are already unique and, once the index exists, their hashes are stored, so they are never compared
+        size_t hash;
+        if (old_hashes != NULL) {
+            hash = old_hashes[i];
         }
+        else {
+            void *key = (unsigned char*) hm + (i * element_size) + key_offset;
+            hash = bfutils_hashmap_key_hash(is_string ? *(char**) key : key, key_size, is_string);
+        }
+        size_t pos = bfutils_hashmap_free_slot(header, hash);
+        header->ctrl[pos] = bfutils_hashmap_tag(hash);
+        header->index[pos] = i;
+        header->hashes[i] = hash;
     }
 
-    if(slots) {
-        BFUTILS_HASHMAP_FREE(slots);
-    }
-    if(old_data) {
-        BFUTILS_HASHMAP_FREE(old_data);
-    }
-    if(removed) {
-        BFUTILS_HASHMAP_FREE(removed);
+    if (old_index) {
+        BFUTILS_HASHMAP_FREE(old_index);
     }
     return hm;
 }
 
-int keycmp(const void *keya, const void *keyb, size_t key_size, int is_string) {
+static inline int keycmp(const void *keya, const void *keyb, size_t key_size, int is_string) {
     if (is_string) {
         return strcmp(keya, *((char**) keyb));
     }
     return memcmp(keya, keyb, key_size);
 }
 
-size_t bfutils_hashmap_insert_position(void *hm, const void *key, size_t element_size, size_t key_offset, size_t key_size, int is_string) {
-    size_t hash = is_string ? bfutils_hashmap_function(key, strlen(key)) : bfutils_hashmap_function(key, key_size);
-    size_t index = hash % bfutils_hashmap_length(hm);
-    size_t slot_index = index % 8;
-    size_t slot_array_index = index / 8;
-    size_t last_array_index = bfutils_hashmap_length(hm) / 8;
-
-    int is_slot_occupied = bfutils_hashmap_slots(hm)[slot_array_index] & (1 << slot_index);
-    int found_removed_slot = 0;
-    size_t removed_slot_index = 0;
-    while (is_slot_occupied) {
-        int is_slot_removed = bfutils_hashmap_removed(hm)[slot_array_index] & (1 << slot_index);
-        if (is_slot_removed && !found_removed_slot) {
-            found_removed_slot = 1;
-            removed_slot_index = slot_array_index * 8 + slot_index;
+// Returns the position of key in a map without index, or -1
+static inline long bfutils_hashmap_find_small(void *hm, const void *key, size_t element_size, size_t key_offset, size_t key_size, int is_string) {
+    BFUtilsHashmapHeader *header = bfutils_hashmap_header(hm);
+    // The first byte rejects most keys without a call
+    unsigned char first = is_string ? *(const unsigned char*) key : 0;
+    for (size_t pos = 0; pos < header->insert_count; pos++) {
+        void *src = (unsigned char*) hm + (pos * element_size) + key_offset;
+        if (is_string && **(unsigned char**) src != first) {
             continue;
         }
-        void *src = (unsigned char*) hm + ((slot_array_index * 8 + slot_index) * element_size) + key_offset;
-        if (0 == keycmp(key, src, key_size, is_string) && !is_slot_removed) {
-            size_t pos = slot_array_index * 8 + slot_index;
-            if (bfutils_hashmap_header(hm)->element_free != NULL) {
-                bfutils_hashmap_header(hm)->element_free((unsigned char*) hm + (element_size * pos));
-            }
+        if (0 == keycmp(key, src, key_size, is_string)) {
             return pos;
         }
+    }
+    return -1;
+}
 
-        slot_index++;
-        if (slot_index == 8){
-            slot_index = 0;
-            slot_array_index = (slot_array_index + 1) % (last_array_index);
+// Looks for key in the probe sequence of hash. Returns the slot pointing to it, or -1 with *available set to the first free slot seen.
+static inline long bfutils_hashmap_find(void *hm, const void *key, size_t hash, size_t element_size, size_t key_offset, size_t key_size, int is_string, long *available) {
+    BFUtilsHashmapHeader *header = bfutils_hashmap_header(hm);
+    // Lengths are powers of two, so the mask is the same as a modulo
+    size_t mask = header->length - 1;
+    size_t group = hash & mask & ~(size_t) (BFUTILS_HASHMAP_GROUP_SIZE - 1);
+    unsigned char tag = bfutils_hashmap_tag(hash);
+    if (available) *available = -1;
+
+    for (size_t probed = 0; probed < header->length; probed += BFUTILS_HASHMAP_GROUP_SIZE) {
+        const unsigned char *ctrl = header->ctrl + group;
+        // Only slots with the same tag can hold the key, the others are never compared
+        for (unsigned match = bfutils_hashmap_group_match(ctrl, tag); match != 0; match &= match - 1) {
+            size_t pos = group + __builtin_ctz(match);
+            void *src = (unsigned char*) hm + (header->index[pos] * element_size) + key_offset;
+            if (0 == keycmp(key, src, key_size, is_string)) {
+                return pos;
+            }
+        }
+        unsigned free_slots = bfutils_hashmap_group_free(ctrl);
+        if (available && *available < 0 && free_slots != 0) {
+            *available = group + __builtin_ctz(free_slots);
         }
-        is_slot_occupied = bfutils_hashmap_slots(hm)[slot_array_index] & (1 << slot_index);
+        // An empty slot ends the probe sequence, the key would have been placed there
+        if (bfutils_hashmap_group_match(ctrl, BFUTILS_HASHMAP_EMPTY) != 0) {
+            return -1;
+        }
+        group = (group + BFUTILS_HASHMAP_GROUP_SIZE) & mask;
     }
-    if (found_removed_slot) {
-        bfutils_hashmap_removed(hm)[removed_slot_index / 8] &= ~(1 << (removed_slot_index % 8));
-        bfutils_hashmap_slots(hm)[removed_slot_index / 8] |= (1 << (removed_slot_index % 8));
+    return -1;
+}
+
+size_t bfutils_hashmap_insert_position(void *hm, const void *key, size_t element_size, size_t key_offset, size_t key_size, int is_string) {
+    BFUtilsHashmapHeader *header = bfutils_hashmap_header(hm);
+    long pos;
+    long available = -1;
+    size_t hash = 0;
+    if (header->length == 0) {
+        pos = bfutils_hashmap_find_small(hm, key, element_size, key_offset, key_size, is_string);
     }
     else {
-        bfutils_hashmap_slots(hm)[slot_array_index] |= (1 << slot_index);
+        hash = bfutils_hashmap_key_hash(key, key_size, is_string);
+        long slot = bfutils_hashmap_find(hm, key, hash, element_size, key_offset, key_size, is_string, &available);
+        pos = slot >= 0 ? (long) header->index[slot] : -1;
+    }
+    if (pos >= 0) {
+        if (header->element_free != NULL) {
+            header->element_free((unsigned char*) hm + (element_size * pos));
+        }
+        return pos;
+    }
+    pos = header->insert_count++;
+    if (header->length > 0) {
+        if (header->ctrl[available] == BFUTILS_HASHMAP_DELETED) {
+            header->deleted--;
+        }
+        header->ctrl[available] = bfutils_hashmap_tag(hash);
+        header->index[available] = pos;
+        header->hashes[pos] = hash;
     }
-    bfutils_hashmap_header(hm)->insert_count++;
-    return slot_array_index * 8 + slot_index;
+    return pos;
 }
 
 long bfutils_hashmap_get_position(void *hm, const void *key, size_t element_size, size_t key_offset, size_t key_size, int is_string) {
-    if (bfutils_hashmap_length(hm) == 0) return -1;
-    size_t hash = is_string ? bfutils_hashmap_function(key, strlen(key)) : bfutils_hashmap_function(key, key_size);
-    size_t index = hash % bfutils_hashmap_length(hm);
-    size_t slot_index = index % 8;
-    size_t slot_array_index = index / 8;
-    size_t last_array_index = bfutils_hashmap_length(hm) / 8;
-
-    int is_slot_occupied = bfutils_hashmap_slots(hm)[slot_array_index] & (1 << slot_index);
-    while (is_slot_occupied) {
-        index = slot_array_index * 8 + slot_index;
-        int is_slot_removed = bfutils_hashmap_removed(hm)[slot_array_index] & (1 << slot_index);
-        if (!is_slot_removed) {
-            void *src = (unsigned char*) hm + (index * element_size) + key_offset;
-            if (0 == keycmp(key, src, key_size, is_string)) {
-                return index;
-            }
-        }
-
-        slot_index++;
-        if (slot_index == 8){
-            slot_index = 0;
-            slot_array_index = (slot_array_index + 1) % last_array_index;
-        }
-        is_slot_occupied = bfutils_hashmap_slots(hm)[slot_array_index] & (1 << slot_index);
+    if (bfutils_hashmap_insert_count(hm) == 0) return -1;
+    BFUtilsHashmapHeader *header = bfutils_hashmap_header(hm);
+    if (header->length == 0) {
+        return bfutils_hashmap_find_small(hm, key, element_size, key_offset, key_size, is_string);
     }
-    return -1;
+    size_t hash = bfutils_hashmap_key_hash(key, key_size, is_string);
+    long slot = bfutils_hashmap_find(hm, key, hash, element_size, key_offset, key_size, is_string, NULL);
+    return slot >= 0 ? (long) header->index[slot] : -1;
 }
 
 void bfutils_hashmap_free_f(void *hm, size_t element_size) {
     if (hm == NULL) return;
     if (bfutils_hashmap_header(hm)->element_free != NULL) {
-        BFUtilsHashmapIterator it = bfutils_hashmap_iterator(hm);
-        while(bfutils_hashmap_iterator_has_next(&it)) {
-            size_t pos = bfutils_hashmap_iterator_next_position(&it);
-            bfutils_hashmap_header(hm)->element_free((unsigned char*) hm + (pos * element_size));
+        for (size_t i = 0; i < bfutils_hashmap_insert_count(hm); i++) {
+            bfutils_hashmap_header(hm)->element_free((unsigned char*) hm + (i * element_size));
         }
     }
 
-    BFUTILS_HASHMAP_FREE(bfutils_hashmap_header(hm)->slots);
-    BFUTILS_HASHMAP_FREE(bfutils_hashmap_header(hm)->removed);
+    if (bfutils_hashmap_header(hm)->index) {
+        BFUTILS_HASHMAP_FREE(bfutils_hashmap_header(hm)->index);
+    }
     BFUTILS_HASHMAP_FREE(bfutils_hashmap_header(hm));
 }
 
 long bfutils_hashmap_remove_key(void *hm, const void *key, size_t element_size, size_t key_offset, size_t key_size, int is_string) {
-    long index = bfutils_hashmap_get_position(hm, key, element_size, key_offset, key_size, is_string);
-    if (index > 0) {
-        size_t slot_index = index % 8;
-        size_t slot_array_index = index / 8;
-        bfutils_hashmap_removed(hm)[slot_array_index] |= (1 << slot_index);
-        bfutils_hashmap_header(hm)->insert_count--;
+    if (bfutils_hashmap_insert_count(hm) == 0) return -1;
+    BFUtilsHashmapHeader *header = bfutils_hashmap_header(hm);
+    long pos;
+    if (header->length == 0) {
+        pos = bfutils_hashmap_find_small(hm, key, element_size, key_offset, key_size, is_string);
+    }
+    else {
+        size_t hash = bfutils_hashmap_key_hash(key, key_size, is_string);
+        long slot = bfutils_hashmap_find(hm, key, hash, element_size, key_offset, key_size, is_string, NULL);
+        pos = slot >= 0 ? (long) header->index[slot] : -1;
+        if (slot >= 0) {
+            // Later keys of the probe sequence may have passed this slot, so it can't become empty again
+            header->ctrl[slot] = BFUTILS_HASHMAP_DELETED;
+            header->deleted++;
+        }
+    }
+    if (pos < 0) {
+        return -1;
+    }
+    size_t last = --header->insert_count;
+    if ((size_t) pos != last) {
+        // The last element fills the hole, and the removed one goes right after the live elements for the caller to read
+        if (header->length > 0) {
+            header->index[bfutils_hashmap_entry_slot(header, header->hashes[last], last)] = pos;
+            header->hashes[pos] = header->hashes[last];
+        }
+        unsigned char *removed = (unsigned char*) hm + (pos * element_size);
+        unsigned char *moved = (unsigned char*) hm + (last * element_size);
+        for (size_t i = 0; i < element_size; i++) {
+            unsigned char c = removed[i];
+            removed[i] = moved[i];
+            moved[i] = c;
+        }
     }
-    return index;
+    return last;
 }
 
-size_t bfutils_hashmap_function(const void* key, size_t key_size) { //SDBM hash function
-    unsigned char *str = (unsigned char *) key;
-    size_t hash = 0;
+// wyhash (final version 4), which reads the key 8 or 16 bytes at a time
+static const uint64_t bfutils_hashmap_secret[4] = {0x2d358dccaa6c78a5ull, 0x8bb84b93962eacc9ull, 0x4b33a62ed433d4a3ull, 0x4d5a2da51de1aa47ull};
+
+static inline void bfutils_hashmap_mum(uint64_t *a, uint64_t *b) {
+#ifdef __SIZEOF_INT128__
+    __uint128_t r = (__uint128_t) *a * *b;
+    *a = (uint64_t) r;
+    *b = (uint64_t) (r >> 64);
+#else
+    uint64_t ha = *a >> 32, hb = *b >> 32, la = (uint32_t) *a, lb = (uint32_t) *b;
+    uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb, t = rl + (rm0 << 32), c = t < rl;
+    uint64_t lo = t + (rm1 << 32);
+    c += lo < t;
+    *a = lo;
+    *b = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+#endif
+}
 
-    for (size_t i = 0; i < key_size; ++str, ++i) {
-        hash = (*str) + (hash << 6) + (hash << 16) - hash;
-    }
+static inline uint64_t bfutils_hashmap_mix(uint64_t a, uint64_t b) {
+    bfutils_hashmap_mum(&a, &b);
+    return a ^ b;
+}
 
-    return hash;
+static inline uint64_t bfutils_hashmap_read8(const uint8_t *p) {
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return v;
 }
 
-BFUtilsHashmapIterator bfutils_hashmap_iterator(void *hm) {
-    unsigned char *slots = bfutils_hashmap_slots(hm);
-    unsigned char *removed = bfutils_hashmap_removed(hm);
-    size_t first = 0;
-    size_t last = 0;
-    int first_set = 0;
-    for(int i = 0; i <= bfutils_hashmap_length(hm) / 8; i++) {
-        for (int j = 0; j < 8; j++) {
-            int is_slot_occupied = slots[i] & (1 << j);
-            int is_removed = removed[i] & (1 << j);
-            if (is_slot_occupied && !is_removed) {
-                if (!first_set) {
-                    first = i*8 + j;
-                    first_set = 1;
-                }
-                last = i*8 + j;
-            }
+static inline uint64_t bfutils_hashmap_read4(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+size_t bfutils_hashmap_seeded_function(const void* key, size_t key_size, unsigned long long seed) {
+    const uint64_t *s = bfutils_hashmap_secret;
+    const uint8_t *p = (const uint8_t*) key;
+    uint64_t a, b;
+    seed ^= bfutils_hashmap_mix(seed ^ s[0], s[1]);
+    if (key_size <= 16) {
+        if (key_size >= 4) {
+            a = (bfutils_hashmap_read4(p) << 32) | bfutils_hashmap_read4(p + ((key_size >> 3) << 2));
+            b = (bfutils_hashmap_read4(p + key_size - 4) << 32) | bfutils_hashmap_read4(p + key_size - 4 - ((key_size >> 3) << 2));
+        }
+        else if (key_size > 0) {
+            a = ((uint64_t) p[0] << 16) | ((uint64_t) p[key_size >> 1] << 8) | p[key_size - 1];
+            b = 0;
+        }
+        else {
+            a = b = 0;
+        }
+    }
+    else {
+        size_t i = key_size;
+        if (i > 48) {
+            uint64_t see1 = seed, see2 = seed;
+            do {
+                seed = bfutils_hashmap_mix(bfutils_hashmap_read8(p) ^ s[1], bfutils_hashmap_read8(p + 8) ^ seed);
+                see1 = bfutils_hashmap_mix(bfutils_hashmap_read8(p + 16) ^ s[2], bfutils_hashmap_read8(p + 24) ^ see1);
+                see2 = bfutils_hashmap_mix(bfutils_hashmap_read8(p + 32) ^ s[3], bfutils_hashmap_read8(p + 40) ^ see2);
+                p += 48;
+                i -= 48;
+            } while (i > 48);
+            seed ^= see1 ^ see2;
         }
+        while (i > 16) {
+            seed = bfutils_hashmap_mix(bfutils_hashmap_read8(p) ^ s[1], bfutils_hashmap_read8(p + 8) ^ seed);
+            i -= 16;
+            p += 16;
+        }
+        a = bfutils_hashmap_read8(p + i - 16);
+        b = bfutils_hashmap_read8(p + i - 8);
     }
+    a ^= s[1];
+    b ^= seed;
+    bfutils_hashmap_mum(&a, &b);
+    return bfutils_hashmap_mix(a ^ s[0] ^ key_size, b ^ s[1]);
+}
+
+size_t bfutils_hashmap_function(const void* key, size_t key_size) {
+    return bfutils_hashmap_seeded_function(key, key_size, bfutils_hashmap_seed);
+}
+
+BFUtilsHashmapIterator bfutils_hashmap_iterator(void *hm) {
+    size_t count = bfutils_hashmap_insert_count(hm);
     return (BFUtilsHashmapIterator) {
         .h = bfutils_hashmap_header(hm),
-        .current = first,
-        .first = first,
-        .last = last,
+        .current = 0,
+        .first = 0,
+        .last = count > 0 ? count - 1 : 0,
     };
 }
 
@@ -458,71 +709,26 @@ BFUtilsHashmapIterator bfutils_hashmap_iterator_reverse(void *hm) {
 
 int bfutils_hashmap_iterator_has_next(BFUtilsHashmapIterator *it) {
     if (it->started == 0) {
-        return it->h->insert_count > 0;
+        return it->h != NULL && it->h->insert_count > 0;
     }
     return it->current < it->last;
 }
 int bfutils_hashmap_iterator_has_previous(BFUtilsHashmapIterator *it) {
     if (it->started == 1) {
-        return it->h->insert_count > 0;
+        return it->h != NULL && it->h->insert_count > 0;
     }
     return it->current > it->first;
 }
 
 size_t bfutils_hashmap_iterator_next_position(BFUtilsHashmapIterator *it) {
-    size_t index = it->started == 0 ? it->first : it->current + 1;
-    size_t slot_index = index % 8;
-    size_t slot_array_index = index / 8;
-
-    unsigned char *slots = it->h->slots;
-    unsigned char *removed = it->h->removed;
-    while (index < it->last) {
-        int is_slot_occupied = slots[slot_array_index] & (1 << slot_index);
-        int is_slot_removed = removed[slot_array_index] & (1 << slot_index);
-        if (is_slot_occupied && !is_slot_removed) {
-            it->started = 2;
-            it->current = index;
-            return it->current;
-        }
-
-        slot_index++;
-        if (slot_index == 8){
-            slot_index = 0;
-            slot_array_index = (slot_array_index + 1) % (it->h->length / 8);
-        }
-        index = slot_array_index * 8 + slot_index;
-    }
+    it->current = it->started == 0 ? it->first : it->current + 1;
     it->started = 2;
-    it->current = it->last;
     return it->current;
 }
 
 size_t bfutils_hashmap_iterator_previous_position(BFUtilsHashmapIterator *it) {
-    size_t index = it->started == 1 ? it->last : it->current - 1;
-    size_t slot_index = index % 8;
-    size_t slot_array_index = index / 8;
-
-    unsigned char *slots = it->h->slots;
-    unsigned char *removed = it->h->removed;
-    while (index > it->first) {
-        int is_slot_occupied = slots[slot_array_index] & (1 << slot_index);
-        int is_slot_removed = removed[slot_array_index] & (1 << slot_index);
-        if (is_slot_occupied && !is_slot_removed) {
-            it->started = 2;
-            it->current = index;
-            return it->current;
-        }
-
-        if (slot_index == 0){
-            slot_index = 7;
-            slot_array_index = (slot_array_index - 1) % (it->h->length / 8);
-        } else {
-            slot_index--;
-        }
-        index = slot_array_index * 8 + slot_index;
-    }
+    it->current = it->started == 1 ? it->last : it->current - 1;
     it->started = 2;
-    it->current = it->first;
     return it->current;
 }
 #endif //BFUTILS_HASHMAP_IMPLEMENTATION
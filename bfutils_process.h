@@ -169,6 +169,14 @@ void read_fd(int fd, char **res) {
     (*res)[count] = '\0';
 }
 
+// Closes the fd only once, a second close could hit a descriptor reused by another thread
+void bfutils_process_close_fd(int *fd) {
+    if (*fd >= 0) {
+        close(*fd);
+        *fd = -1;
+    }
+}
+
 void close_pair(int *fd) {
     close(fd[0]);
     close(fd[1]);
@@ -199,14 +207,14 @@ BFUtilsProcess bfutils_process_async(char *const *cmd) {
     int stdout_fd[2];
     int stderr_fd[2];
 
-    if (pipe(stdin_fd) < 0) {
+    if (pipe2(stdin_fd, O_CLOEXEC) < 0) {
         return process;
     }
-    if (pipe(stdout_fd) < 0) {
+    if (pipe2(stdout_fd, O_CLOEXEC) < 0) {
         close_pair(stdin_fd);
         return process;
     }
-    if (pipe(stderr_fd) < 0) {
+    if (pipe2(stderr_fd, O_CLOEXEC) < 0) {
         close_pair(stdin_fd);
         close_pair(stdout_fd);
         return process;
@@ -244,7 +252,7 @@ BFUtilsProcess bfutils_process_async(char *const *cmd) {
             close_pair(stderr_fd);
 
             execvp(cmd[0], cmd);
-            break;
+            _exit(127);
         default:
             process.pid = pid;
             process.stdin_fd = stdin_fd[1];
@@ -302,7 +310,7 @@ char *bfutils_process_read_stderr(BFUtilsProcess *p) {
 
 int bfutils_process_wait(BFUtilsProcess *p) {
     int status;
-    close(p->stdin_fd);
+    bfutils_process_close_fd(&p->stdin_fd);
     int wpid = waitpid(p->pid, &status, 0);
     if (wpid < 0) {
         return -1;
@@ -321,7 +329,7 @@ int bfutils_process_wait(BFUtilsProcess *p) {
 
 int bfutils_process_is_running(BFUtilsProcess *p, int *s) {
     int status;
-    close(p->stdin_fd);
+    bfutils_process_close_fd(&p->stdin_fd);
     int wpid = waitpid(p->pid, &status, WNOHANG);
     if (wpid < 0) {
         return -1;
@@ -341,8 +349,8 @@ int bfutils_process_is_running(BFUtilsProcess *p, int *s) {
 }
 
 void bfutils_process_close(BFUtilsProcess *p) {
-    close(p->stdin_fd);
-    close(p->stdout_fd);
-    close(p->stderr_fd);
+    bfutils_process_close_fd(&p->stdin_fd);
+    bfutils_process_close_fd(&p->stdout_fd);
+    bfutils_process_close_fd(&p->stderr_fd);
 }
 #endif //BFUTILS_PROCESS_IMPLEMENTATION
@@ -32,9 +32,19 @@ USAGE:
         vector_ensure_capacity:
             void vector_ensure_capacity(T*, size_t); If current capacity is less that provided, grows the vector to provided capacity.
 
+        vector_reserve:
+            void vector_reserve(T*, size_t); Makes room for at least n more elements. The capacity grows geometrically, so repeated appends are amortized O(1).
+
         vector_push:
             void vector_push(T*, T); Insert element to end of the vector. Grows the vector if required.
 
+        vector_push_n:
+            void vector_push_n(T*, const T*, size_t); Appends n elements copied from an array with a single memcpy.
+
+        vector_commit:
+            void vector_commit(T*, size_t); Adds n elements, already written after the end of the vector, to its length.
+            Used with vector_reserve to write directly into the vector.
+
         vector_pop:
             T vector_pop(T*); Removes and return the last element in the vector.
 
@@ -50,6 +60,17 @@ USAGE:
             void string_push_cstr(char *, const char*); Appends to the end of a char* vector a null terminated string. 
             It inserts a NULL byte at the end without incrementing the length.
 
+        string_push_bytes:
+            void string_push_bytes(char *, const char*, size_t); Appends n bytes to the end of a char* vector. The bytes may contain NULL bytes.
+            It inserts a NULL byte at the end without incrementing the length.
+
+        string_reserve:
+            char *string_reserve(char *, size_t); Makes room for n more bytes and the NULL byte, and returns a pointer to the end of the string.
+            After writing up to n bytes there, call string_commit with the amount written.
+
+        string_commit:
+            void string_commit(char *, size_t); Adds n bytes written after string_reserve to the length and inserts the NULL byte.
+
         string_split:
             char **string_split(const char *, const char*); Splits a NULL terminated string by a delimiter. Returns a vector of NULL terminated strings.
             The returned vector needs to be free by calling vector_free on each element and itself.
@@ -107,11 +128,17 @@ LICENSE:
 #define vector_capacity bfutils_vector_capacity
 #define vector_length bfutils_vector_length
 #define vector_ensure_capacity bfutils_vector_ensure_capacity
+#define vector_reserve bfutils_vector_reserve
 #define vector_push bfutils_vector_push
+#define vector_push_n bfutils_vector_push_n
+#define vector_commit bfutils_vector_commit
 #define vector_pop bfutils_vector_pop
 #define vector_free bfutils_vector_free
 #define string_push bfutils_string_push_str
 #define string_push_cstr bfutils_string_push_cstr
+#define string_push_bytes bfutils_string_push_bytes
+#define string_reserve bfutils_string_reserve
+#define string_commit bfutils_string_commit
 #define string_split bfutils_string_split
 #define string_format bfutils_string_format
 
@@ -145,8 +172,14 @@ typedef struct {
 #define bfutils_vector_pop(v) ((v)[--bfutils_vector_header((v))->length])
 #define bfutils_vector_free(v) (bfutils_vector_free_func(v, sizeof(*(v))), (v) = NULL)
 #define bfutils_vector_ensure_capacity(v, c) ((v) = bfutils_vector_capacity_grow((v), sizeof(*(v)), (c)))
+#define bfutils_vector_reserve(v, n) ((v) = bfutils_vector_reserve_f((v), sizeof(*(v)), (n)))
+#define bfutils_vector_push_n(v, a, n) ((v) = bfutils_vector_push_n_f((v), sizeof(*(v)), (a), (n)))
+#define bfutils_vector_commit(v, n) (bfutils_vector_header((v))->length += (n))
 #define bfutils_string_push_cstr(s, a) ((s) = bfutils_string_push_cstr_f((s), (a)))
 #define bfutils_string_push_str(s, a) ((s) = bfutils_string_push_str_f((s), (a)))
+#define bfutils_string_push_bytes(s, a, n) ((s) = bfutils_string_push_bytes_f((s), (a), (n)))
+#define bfutils_string_reserve(s, n) (bfutils_vector_reserve((s), (n) + 1), (s) + bfutils_vector_length((s)))
+#define bfutils_string_commit(s, n) (bfutils_vector_commit((s), (n)), (s)[bfutils_vector_length((s))] = '\0')
 #define bfutils_vector(element_free) (bfutils_vector_with_free((element_free)))
 
 #define BFUTILS_VECTOR_FREE_WRAPPER(name, T, f) void name(void *addr) {\
@@ -158,6 +191,9 @@ typedef struct {
 extern void *bfutils_vector_with_free(void (*element_free)(void*));
 extern void *bfutils_vector_grow(void *vector, size_t element_size, size_t length);
 extern void *bfutils_vector_capacity_grow(void *vector, size_t element_size, size_t capacity);
+extern void *bfutils_vector_reserve_f(void *vector, size_t element_size, size_t n);
+extern void *bfutils_vector_push_n_f(void *vector, size_t element_size, const void *elements, size_t n);
+extern char* bfutils_string_push_bytes_f(char *str, const char *bytes, size_t n);
 extern char* bfutils_string_push_cstr_f(char *str, const char *cstr);
 extern char* bfutils_string_push_str_f(char *str, const char *s);
 extern char** bfutils_string_split(const char *cstr, const char *delim);
@@ -217,26 +253,44 @@ void *bfutils_vector_capacity_grow(void *vector, size_t element_size, size_t cap
     return vector;
 }
 
-char *bfutils_string_push_cstr_f(char *str, const char *cstr) {
-    if (cstr == NULL) 
-        return str;
-    bfutils_vector_ensure_capacity(str, vector_length(str) + strlen(cstr) + 1);
-    for (int i = 0; i < strlen(cstr); i++) {
-        bfutils_vector_push(str, cstr[i]);
+void *bfutils_vector_reserve_f(void *vector, size_t element_size, size_t n) {
+    size_t required = bfutils_vector_length(vector) + n;
+    if (bfutils_vector_capacity(vector) < required || vector == NULL) {
+        size_t capacity = bfutils_vector_new_capacity(vector);
+        vector = bfutils_vector_capacity_grow(vector, element_size, capacity > required ? capacity : required);
     }
-    str[bfutils_vector_length(str)] = '\0'; //Inserts \0 without incrementing length
-    return str;
+    return vector;
 }
 
-char *bfutils_string_push_str_f(char *str, const char *s) {
-    bfutils_vector_ensure_capacity(str, vector_length(str) + vector_length(s) + 1);
-    for (int i = 0; i < bfutils_vector_length(s); i++) {
-        bfutils_vector_push(str, s[i]);
+void *bfutils_vector_push_n_f(void *vector, size_t element_size, const void *elements, size_t n) {
+    vector = bfutils_vector_reserve_f(vector, element_size, n);
+    if (n > 0) {
+        memcpy((unsigned char*) vector + (element_size * bfutils_vector_length(vector)), elements, element_size * n);
+        bfutils_vector_header(vector)->length += n;
+    }
+    return vector;
+}
+
+char *bfutils_string_push_bytes_f(char *str, const char *bytes, size_t n) {
+    str = bfutils_vector_reserve_f(str, sizeof(char), n + 1);
+    if (n > 0) {
+        memcpy(str + bfutils_vector_length(str), bytes, n);
+        bfutils_vector_header(str)->length += n;
     }
     str[bfutils_vector_length(str)] = '\0'; //Inserts \0 without incrementing length
     return str;
 }
 
+char *bfutils_string_push_cstr_f(char *str, const char *cstr) {
+    if (cstr == NULL) 
+        return str;
+    return bfutils_string_push_bytes_f(str, cstr, strlen(cstr));
+}
+
+char *bfutils_string_push_str_f(char *str, const char *s) {
+    return bfutils_string_push_bytes_f(str, s, bfutils_vector_length(s));
+}
+
 char **bfutils_string_split(const char *cstr, const char *delim) {
     char **list = NULL;
     char *saveptr = NULL;
@@ -5,8 +5,16 @@
 void bfutils_build(int argc, char *argv[]) {
     BFUtilsBuildCfg server = {
         .name = "server",
-        .files = (char*[]) { "server.c" },
-        .files_len = 1,
+        .files = (char*[]) { "server.c", "mime.c", "file_cache.c", "http_parser.c", "scan.c", "request_body.c", "input_buffer.c", "arena.c", "uring.c", "compress.c" },
+        .files_len = 10,
+        .ldflags = "-pthread -lz -lbrotlienc",
     };
     bfutils_add_executable(server);
+
+    BFUtilsBuildCfg bench = {
+        .name = "bench",
+        .files = (char*[]) { "bench.c", "http_parser.c", "scan.c" },
+        .files_len = 3,
+    };
+    bfutils_add_executable(bench);
 }
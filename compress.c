@@ -0,0 +1,116 @@
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+#include <brotli/encode.h>
+#include "compress.h"
+#include "bfutils_vector.h"
+
+static const char *compress_types[] = {
+    "application/javascript",
+    "application/json",
+    "application/xml",
+    "application/wasm",
+    "image/svg+xml",
+    "image/x-icon",
+    "font/ttf",
+    "font/otf",
+};
+
+int compress_eligible(const char *mime) {
+    size_t length = strcspn(mime, ";");
+    if (0 == strncmp(mime, "text/", 5)) {
+        return 1;
+    }
+    // Structured syntax suffixes, as in application/ld+json
+    if ((length > 5 && 0 == strncmp(mime + length - 5, "+json", 5)) || (length > 4 && 0 == strncmp(mime + length - 4, "+xml", 4))) {
+        return 1;
+    }
+    for (size_t i = 0; i < sizeof(compress_types) / sizeof(compress_types[0]); i++) {
+        if (strlen(compress_types[i]) == length && 0 == strncmp(mime, compress_types[i], length)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static size_t compress_gzip(const char *data, size_t size, char *out, size_t capacity) {
+    z_stream stream = {0};
+    // 16 added to the window bits asks for a gzip header and trailer instead of the zlib ones
+    if (deflateInit2(&stream, COMPRESS_GZIP_LEVEL, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return 0;
+    }
+    stream.next_in = (unsigned char*) data;
+    stream.avail_in = size;
+    stream.next_out = (unsigned char*) out;
+    stream.avail_out = capacity;
+    int status = deflate(&stream, Z_FINISH);
+    size_t length = stream.total_out;
+    deflateEnd(&stream);
+    return status == Z_STREAM_END ? length : 0;
+}
+
+static size_t compress_brotli(const char *data, size_t size, char *out, size_t capacity) {
+    size_t length = capacity;
+    if (!BrotliEncoderCompress(COMPRESS_BROTLI_QUALITY, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_TEXT, size,
+                               (const uint8_t*) data, &length, (uint8_t*) out)) {
+        return 0;
+    }
+    return length;
+}
+
+char *compress_data(HttpContentEncoding encoding, const char *data, size_t size) {
+    size_t capacity;
+    switch (encoding) {
+        case HTTP_ENCODING_GZIP: capacity = deflateBound(NULL, size) + 18; break; // deflateBound counts a zlib wrapper
+        case HTTP_ENCODING_BR: capacity = BrotliEncoderMaxCompressedSize(size); break;
+        default: return NULL;
+    }
+    char *out = NULL;
+    vector_ensure_capacity(out, capacity);
+    size_t length = encoding == HTTP_ENCODING_GZIP ? compress_gzip(data, size, out, capacity) : compress_brotli(data, size, out, capacity);
+    if (length == 0 || length >= size) {
+        vector_free(out);
+        return NULL;
+    }
+    vector_header(out)->length = length;
+    return out;
+}
+
+struct CompressStream {
+    z_stream zlib;
+};
+
+CompressStream *compress_stream_new(HttpContentEncoding encoding) {
+    if (encoding != HTTP_ENCODING_GZIP) {
+        return NULL;
+    }
+    CompressStream *stream = calloc(1, sizeof(CompressStream));
+    if (stream == NULL) {
+        return NULL;
+    }
+    if (deflateInit2(&stream->zlib, COMPRESS_GZIP_LEVEL, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        free(stream);
+        return NULL;
+    }
+    return stream;
+}
+
+size_t compress_stream_write(CompressStream *stream, const char **input, size_t *length, char *out, size_t capacity,
+                             int finish, int *done) {
+    stream->zlib.next_in = (unsigned char*) *input;
+    stream->zlib.avail_in = *length;
+    stream->zlib.next_out = (unsigned char*) out;
+    stream->zlib.avail_out = capacity;
+    int status = deflate(&stream->zlib, finish ? Z_FINISH : Z_NO_FLUSH);
+    *done = status == Z_STREAM_END;
+    *input += *length - stream->zlib.avail_in;
+    *length = stream->zlib.avail_in;
+    return capacity - stream->zlib.avail_out;
+}
+
+void compress_stream_free(CompressStream *stream) {
+    if (stream != NULL) {
+        deflateEnd(&stream->zlib);
+        free(stream);
+    }
+}
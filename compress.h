@@ -0,0 +1,32 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include <stddef.h>
+#include "http_parser.h"
+
+// Variants are made once per file version, on the request that first asks for them
+#define COMPRESS_GZIP_LEVEL 6
+#define COMPRESS_BROTLI_QUALITY 9
+
+// Returns a non-zero value for text-like types that are worth compressing on the fly
+int compress_eligible(const char *mime);
+
+// Returns the data compressed with encoding as a vector, or NULL if the encoding can't be produced here
+// or the result is not smaller than the data
+char *compress_data(HttpContentEncoding encoding, const char *data, size_t size);
+
+// Compresses a body piece by piece, for files too big to be compressed at once. Its memory use is fixed.
+typedef struct CompressStream CompressStream;
+
+// Returns NULL if the encoding can't be streamed, only gzip can
+CompressStream *compress_stream_new(HttpContentEncoding encoding);
+
+// Compresses up to *length bytes from *input into out, moving *input and *length past the bytes consumed.
+// finish is set once the rest of the input is in *input. Returns the number of bytes written to out,
+// *done is set when they end the stream.
+size_t compress_stream_write(CompressStream *stream, const char **input, size_t *length, char *out, size_t capacity,
+                             int finish, int *done);
+
+void compress_stream_free(CompressStream *stream);
+
+#endif //COMPRESS_H
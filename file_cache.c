@@ -0,0 +1,519 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <limits.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include <sys/eventfd.h>
+#include "file_cache.h"
+#include "mime.h"
+#include "compress.h"
+#include "arena.h"
+#include "bfutils_vector.h"
+#include "bfutils_hash.h"
+
+#define FILE_CACHE_WATCH_EVENTS (IN_CLOSE_WRITE | IN_MODIFY | IN_ATTRIB | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF)
+
+typedef struct {
+    char *key;
+    FileCacheEntry *value;
+} FileCacheItem;
+
+typedef struct {
+    int key;
+    char *value;
+} FileCacheWatch;
+
+static struct {
+    int enabled;
+    pthread_mutex_t lock;
+    FileCacheItem *entries;
+    // Entries ordered by use, the tail is the first to be evicted
+    FileCacheEntry *head;
+    FileCacheEntry *tail;
+    size_t capacity;
+    size_t used;
+    // Incremented on every invalidation, so a file read concurrently with a change is not cached
+    unsigned long generation;
+    FileCacheWatch *watches;
+    int inotify_fd;
+    int stop_fd;
+    pthread_t watcher;
+} file_cache = {.lock = PTHREAD_MUTEX_INITIALIZER, .inotify_fd = -1, .stop_fd = -1};
+
+static void file_validators_init(FileValidators *validators, const struct stat *file_stat) {
+    snprintf(validators->etag, sizeof(validators->etag), "\"%lx-%lx-%lx.%lx\"", (unsigned long) file_stat->st_ino,
+             (unsigned long) file_stat->st_size, (unsigned long) file_stat->st_mtim.tv_sec, (unsigned long) file_stat->st_mtim.tv_nsec);
+    validators->mtime = file_stat->st_mtim.tv_sec;
+}
+
+void file_validators_encode(FileValidators *validators, HttpContentEncoding encoding) {
+    // The suffix goes inside the quotes
+    size_t length = strlen(validators->etag);
+    snprintf(validators->etag + length - 1, sizeof(validators->etag) - length + 1, "-%s\"", http_encoding_names[encoding]);
+}
+
+// Returns a read-only descriptor for a regular file, or -1 if the path does not name one.
+// validators is set unless it is NULL.
+static int open_regular_file(const char *path, size_t *size, FileValidators *validators) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) < 0 || !S_ISREG(file_stat.st_mode)) {
+        close(fd);
+        return -1;
+    }
+    *size = file_stat.st_size;
+    if (validators != NULL) {
+        file_validators_init(validators, &file_stat);
+    }
+    return fd;
+}
+
+// Preferred first when the client accepts several
+static const HttpContentEncoding file_cache_encodings[] = {HTTP_ENCODING_BR, HTTP_ENCODING_ZSTD, HTTP_ENCODING_GZIP};
+
+// Stored in variants when an encoding was tried and there is nothing better than the entry itself
+static FileCacheEntry file_cache_no_variant;
+
+static int file_cache_has_variant(FileCacheEntry *entry, HttpContentEncoding encoding) {
+    return entry->variants[encoding] != NULL && entry->variants[encoding] != &file_cache_no_variant;
+}
+
+// Variants are accounted with their entry, so they are evicted together
+static size_t file_cache_entry_cost(FileCacheEntry *entry) {
+    size_t cost = sizeof(FileCacheEntry) + entry->size + vector_length(entry->path) + vector_length(entry->headers);
+    for (int i = 0; i < HTTP_ENCODING_COUNT; i++) {
+        if (file_cache_has_variant(entry, i)) {
+            cost += file_cache_entry_cost(entry->variants[i]);
+        }
+    }
+    return cost;
+}
+
+static void file_cache_entry_free(FileCacheEntry *entry) {
+    for (int i = 0; i < HTTP_ENCODING_COUNT; i++) {
+        if (file_cache_has_variant(entry, i)) {
+            file_cache_release(entry->variants[i]);
+        }
+    }
+    vector_free(entry->path);
+    vector_free(entry->data);
+    vector_free(entry->headers);
+    free(entry);
+}
+
+void file_cache_release(FileCacheEntry *entry) {
+    if (atomic_fetch_sub(&entry->refs, 1) == 1) {
+        file_cache_entry_free(entry);
+    }
+}
+
+static void file_cache_list_unlink(FileCacheEntry *entry) {
+    if (entry->prev) entry->prev->next = entry->next;
+    else file_cache.head = entry->next;
+    if (entry->next) entry->next->prev = entry->prev;
+    else file_cache.tail = entry->prev;
+    entry->prev = NULL;
+    entry->next = NULL;
+}
+
+static void file_cache_list_push(FileCacheEntry *entry) {
+    entry->next = file_cache.head;
+    if (file_cache.head) file_cache.head->prev = entry;
+    else file_cache.tail = entry;
+    file_cache.head = entry;
+}
+
+// Must be called with the lock held
+static void file_cache_remove_locked(FileCacheEntry *entry) {
+    file_cache_list_unlink(entry);
+    (void) string_hashmap_remove(file_cache.entries, entry->path);
+    file_cache.used -= file_cache_entry_cost(entry);
+    file_cache_release(entry);
+}
+
+static void file_cache_invalidate(const char *path) {
+    pthread_mutex_lock(&file_cache.lock);
+    file_cache.generation++;
+    if (string_hashmap_contains(file_cache.entries, path)) {
+        file_cache_remove_locked(string_hashmap_get(file_cache.entries, path));
+    }
+    pthread_mutex_unlock(&file_cache.lock);
+}
+
+static void file_cache_clear(void) {
+    pthread_mutex_lock(&file_cache.lock);
+    file_cache.generation++;
+    while (file_cache.head != NULL) {
+        file_cache_remove_locked(file_cache.head);
+    }
+    pthread_mutex_unlock(&file_cache.lock);
+}
+
+// Takes ownership of data. The validators are the ones of the file the entry was made from.
+static FileCacheEntry *file_cache_entry_new(const char *path, char *data, const char *mime, HttpContentEncoding encoding,
+                                            const FileValidators *validators) {
+    arena_assert_heap();
+    FileCacheEntry *entry = calloc(1, sizeof(FileCacheEntry));
+    entry->data = data;
+    entry->size = vector_length(data);
+    string_push_cstr(entry->path, path);
+    entry->mime = mime;
+    entry->encoding = encoding;
+    entry->validators = *validators;
+    string_push_cstr(entry->headers, "Content-Type: ");
+    string_push_cstr(entry->headers, mime);
+    string_push_cstr(entry->headers, "\r\n");
+    if (encoding != HTTP_ENCODING_IDENTITY) {
+        file_validators_encode(&entry->validators, encoding);
+        string_push_cstr(entry->headers, "Content-Encoding: ");
+        string_push_cstr(entry->headers, http_encoding_names[encoding]);
+        string_push_cstr(entry->headers, "\r\n");
+    }
+    if (encoding != HTTP_ENCODING_IDENTITY || compress_eligible(mime)) {
+        string_push_cstr(entry->headers, "Vary: Accept-Encoding\r\n");
+    }
+    char date[HTTP_DATE_LENGTH + 1];
+    http_format_date(date, entry->validators.mtime);
+    char *lines = string_format("Accept-Ranges: bytes\r\nETag: %s\r\nLast-Modified: %s\r\n", entry->validators.etag, date);
+    string_push(entry->headers, lines);
+    vector_free(lines);
+    entry->content_length_offset = vector_length(entry->headers);
+    lines = string_format("Content-Length: %zu\r\n", entry->size);
+    string_push(entry->headers, lines);
+    vector_free(lines);
+    atomic_init(&entry->refs, 1);
+    return entry;
+}
+
+static FileCacheEntry *file_cache_load(const char *path, int fd, size_t size, const char *mime, HttpContentEncoding encoding,
+                                       const FileValidators *validators) {
+    char *data = NULL;
+    vector_ensure_capacity(data, size + 1);
+    size_t read = 0;
+    while (read < size) {
+        ssize_t l = pread(fd, data + read, size - read, read);
+        if (l < 0 && errno == EINTR) {
+            continue;
+        }
+        if (l <= 0) {
+            break;
+        }
+        read += l;
+    }
+    if (read != size) {
+        vector_free(data); // The file changed while it was read
+        return NULL;
+    }
+    vector_header(data)->length = size;
+    return file_cache_entry_new(path, data, mime, encoding, validators);
+}
+
+static FileCacheEntry *file_cache_lookup(const char *path, int *fd, size_t *size, FileValidators *validators) {
+    unsigned long generation = 0;
+    *fd = -1;
+    if (file_cache.enabled) {
+        pthread_mutex_lock(&file_cache.lock);
+        if (string_hashmap_contains(file_cache.entries, path)) {
+            FileCacheEntry *entry = string_hashmap_get(file_cache.entries, path);
+            atomic_fetch_add(&entry->refs, 1);
+            file_cache_list_unlink(entry);
+            file_cache_list_push(entry);
+            pthread_mutex_unlock(&file_cache.lock);
+            *validators = entry->validators;
+            return entry;
+        }
+        generation = file_cache.generation;
+        pthread_mutex_unlock(&file_cache.lock);
+    }
+
+    *fd = open_regular_file(path, size, validators);
+    size_t max_size = file_cache.capacity < FILE_CACHE_MAX_FILE_SIZE ? file_cache.capacity : FILE_CACHE_MAX_FILE_SIZE;
+    if (*fd < 0 || !file_cache.enabled || *size > max_size) {
+        return NULL;
+    }
+    FileCacheEntry *entry = file_cache_load(path, *fd, *size, mime_type(path), HTTP_ENCODING_IDENTITY, validators);
+    if (entry == NULL) {
+        return NULL;
+    }
+    close(*fd);
+    *fd = -1;
+
+    pthread_mutex_lock(&file_cache.lock);
+    // If the file changed or another worker loaded it meanwhile, the entry is only used for this response
+    if (generation == file_cache.generation && !string_hashmap_contains(file_cache.entries, entry->path)) {
+        atomic_fetch_add(&entry->refs, 1);
+        string_hashmap_push(file_cache.entries, entry->path, entry);
+        file_cache_list_push(entry);
+        file_cache.used += file_cache_entry_cost(entry);
+        while (file_cache.used > file_cache.capacity && file_cache.tail != entry) {
+            file_cache_remove_locked(file_cache.tail);
+        }
+    }
+    pthread_mutex_unlock(&file_cache.lock);
+    return entry;
+}
+
+FileCacheEntry *file_cache_open(const char *path, int *fd, size_t *size, FileValidators *validators) {
+    ARENA_HEAP_SCOPE;
+    return file_cache_lookup(path, fd, size, validators);
+}
+
+// Loads the precompressed sibling of entry, or compresses its data. Returns NULL when neither gives a smaller body.
+static FileCacheEntry *file_cache_make_variant(FileCacheEntry *entry, HttpContentEncoding encoding) {
+    char *sibling = string_format("%s%s", entry->path, http_encoding_extensions[encoding]);
+    FileCacheEntry *variant = NULL;
+    size_t size;
+    int fd = open_regular_file(sibling, &size, NULL);
+    if (fd >= 0) {
+        if (size <= FILE_CACHE_MAX_FILE_SIZE) {
+            // Siblings are invalidated with the original file, so they share its validators
+            variant = file_cache_load(sibling, fd, size, entry->mime, encoding, &entry->validators);
+        }
+        close(fd);
+    }
+    else if (compress_eligible(entry->mime)) {
+        char *data = compress_data(encoding, entry->data, entry->size);
+        if (data != NULL) {
+            variant = file_cache_entry_new(entry->path, data, entry->mime, encoding, &entry->validators);
+        }
+    }
+    vector_free(sibling);
+    return variant;
+}
+
+static FileCacheEntry *file_cache_get_variant(FileCacheEntry *entry, HttpContentEncoding encoding) {
+    pthread_mutex_lock(&file_cache.lock);
+    FileCacheEntry *variant = entry->variants[encoding];
+    if (variant != NULL) {
+        if (variant == &file_cache_no_variant) {
+            variant = NULL;
+        }
+        else {
+            atomic_fetch_add(&variant->refs, 1);
+        }
+        pthread_mutex_unlock(&file_cache.lock);
+        return variant;
+    }
+    pthread_mutex_unlock(&file_cache.lock);
+
+    // Compressing can take a while, the lock is not held meanwhile
+    variant = file_cache_make_variant(entry, encoding);
+
+    pthread_mutex_lock(&file_cache.lock);
+    // An entry that was invalidated or evicted meanwhile keeps no variants, this one is only used for this response
+    int indexed = string_hashmap_contains(file_cache.entries, entry->path) && string_hashmap_get(file_cache.entries, entry->path) == entry;
+    if (indexed && entry->variants[encoding] == NULL) {
+        if (variant != NULL) {
+            atomic_fetch_add(&variant->refs, 1);
+            entry->variants[encoding] = variant;
+            file_cache.used += file_cache_entry_cost(variant);
+            while (file_cache.used > file_cache.capacity && file_cache.tail != entry) {
+                file_cache_remove_locked(file_cache.tail);
+            }
+        }
+        else {
+            entry->variants[encoding] = &file_cache_no_variant;
+        }
+    }
+    pthread_mutex_unlock(&file_cache.lock);
+    return variant;
+}
+
+FileCacheEntry *file_cache_variant(FileCacheEntry *entry, unsigned encodings) {
+    ARENA_HEAP_SCOPE;
+    FileCacheEntry *variant = NULL;
+    for (size_t i = 0; i < sizeof(file_cache_encodings) / sizeof(file_cache_encodings[0]) && variant == NULL; i++) {
+        if (encodings & (1u << file_cache_encodings[i])) {
+            variant = file_cache_get_variant(entry, file_cache_encodings[i]);
+        }
+    }
+    return variant;
+}
+
+int file_cache_open_sibling(const char *path, unsigned encodings, HttpContentEncoding *encoding, size_t *size) {
+    for (size_t i = 0; i < sizeof(file_cache_encodings) / sizeof(file_cache_encodings[0]); i++) {
+        if (!(encodings & (1u << file_cache_encodings[i]))) {
+            continue;
+        }
+        char sibling[PATH_MAX];
+        if (snprintf(sibling, sizeof(sibling), "%s%s", path, http_encoding_extensions[file_cache_encodings[i]]) >= (int) sizeof(sibling)) {
+            continue;
+        }
+        int fd = open_regular_file(sibling, size, NULL);
+        if (fd >= 0) {
+            *encoding = file_cache_encodings[i];
+            return fd;
+        }
+    }
+    return -1;
+}
+
+void file_cache_watch_free(void *obj) {
+    FileCacheWatch *watch = (FileCacheWatch*) obj;
+    vector_free(watch->value);
+}
+
+// Watches dir and every directory below it, inotify watches are not recursive
+static int file_cache_watch_tree(const char *dir) {
+    int wd = inotify_add_watch(file_cache.inotify_fd, dir, FILE_CACHE_WATCH_EVENTS | IN_ONLYDIR);
+    if (wd < 0) {
+        perror("inotify_add_watch");
+        return -1;
+    }
+    char *path = NULL;
+    string_push_cstr(path, dir);
+    hashmap_push(file_cache.watches, wd, path);
+
+    DIR *d = opendir(dir);
+    if (d == NULL) {
+        return 0;
+    }
+    struct dirent *ent;
+    while ((ent = readdir(d)) != NULL) {
+        if (0 == strcmp(ent->d_name, ".") || 0 == strcmp(ent->d_name, "..")) {
+            continue;
+        }
+        char *child = string_format("%s/%s", dir, ent->d_name);
+        struct stat child_stat;
+        int is_dir = ent->d_type == DT_DIR || (ent->d_type == DT_UNKNOWN && lstat(child, &child_stat) == 0 && S_ISDIR(child_stat.st_mode));
+        if (is_dir) {
+            file_cache_watch_tree(child);
+        }
+        vector_free(child);
+    }
+    closedir(d);
+    return 0;
+}
+
+static void file_cache_handle_event(struct inotify_event *event) {
+    if (event->mask & IN_Q_OVERFLOW) {
+        file_cache_clear();
+        return;
+    }
+    if (!hashmap_contains(file_cache.watches, event->wd)) {
+        return;
+    }
+    char *dir = hashmap_get(file_cache.watches, event->wd);
+    if (event->mask & IN_IGNORED) {
+        (void) hashmap_remove(file_cache.watches, event->wd);
+        vector_free(dir);
+        return;
+    }
+    if (event->mask & (IN_ISDIR | IN_DELETE_SELF | IN_MOVE_SELF)) {
+        // A whole subtree appeared, moved or disappeared
+        if (event->len > 0 && event->mask & (IN_CREATE | IN_MOVED_TO)) {
+            char *child = string_format("%s/%s", dir, event->name);
+            file_cache_watch_tree(child);
+            vector_free(child);
+        }
+        file_cache_clear();
+        return;
+    }
+    if (event->len > 0) {
+        char *path = string_format("%s/%s", dir, event->name);
+        file_cache_invalidate(path);
+        // A precompressed sibling changed, the variant made from it is kept with the original file's entry
+        for (int i = HTTP_ENCODING_GZIP; i < HTTP_ENCODING_COUNT; i++) {
+            size_t length = vector_length(path);
+            size_t extension = strlen(http_encoding_extensions[i]);
+            if (length > extension && 0 == strcmp(path + length - extension, http_encoding_extensions[i])) {
+                path[length - extension] = '\0';
+                file_cache_invalidate(path);
+                break;
+            }
+        }
+        vector_free(path);
+    }
+}
+
+static void *file_cache_watch(void *arg) {
+    (void) arg;
+    char buffer[16 * 1024] __attribute__((aligned(__alignof__(struct inotify_event))));
+    struct pollfd fds[2] = {
+        {.fd = file_cache.inotify_fd, .events = POLLIN},
+        {.fd = file_cache.stop_fd, .events = POLLIN},
+    };
+    while (1) {
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) continue;
+            perror("poll");
+            break;
+        }
+        if (fds[1].revents) {
+            break;
+        }
+        ssize_t l = read(file_cache.inotify_fd, buffer, sizeof(buffer));
+        if (l < 0) {
+            if (errno == EINTR || errno == EAGAIN) continue;
+            perror("read");
+            break;
+        }
+        for (char *p = buffer; p < buffer + l;) {
+            struct inotify_event *event = (struct inotify_event*) p;
+            file_cache_handle_event(event);
+            p += sizeof(struct inotify_event) + event->len;
+        }
+    }
+    return NULL;
+}
+
+int file_cache_init(const char *root, size_t capacity) {
+    file_cache.capacity = capacity;
+    if (capacity == 0) {
+        return 0;
+    }
+    file_cache.inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (file_cache.inotify_fd < 0) {
+        perror("inotify_init1");
+        return -1;
+    }
+    file_cache.stop_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (file_cache.stop_fd < 0) {
+        perror("eventfd");
+        return -1;
+    }
+    file_cache.watches = hashmap(file_cache_watch_free);
+    if (file_cache_watch_tree(root) < 0) {
+        return -1;
+    }
+    int err = pthread_create(&file_cache.watcher, NULL, file_cache_watch, NULL);
+    if (err != 0) {
+        fprintf(stderr, "pthread_create: %s\n", strerror(err));
+        return -1;
+    }
+    file_cache.enabled = 1;
+    return 0;
+}
+
+void file_cache_shutdown(void) {
+    if (file_cache.enabled) {
+        uint64_t one = 1;
+        if (write(file_cache.stop_fd, &one, sizeof(one)) < 0) {
+            perror("write");
+        }
+        pthread_join(file_cache.watcher, NULL);
+        file_cache_clear();
+        file_cache.enabled = 0;
+    }
+    hashmap_free(file_cache.entries);
+    hashmap_free(file_cache.watches);
+    if (file_cache.inotify_fd >= 0) {
+        close(file_cache.inotify_fd);
+        file_cache.inotify_fd = -1;
+    }
+    if (file_cache.stop_fd >= 0) {
+        close(file_cache.stop_fd);
+        file_cache.stop_fd = -1;
+    }
+}
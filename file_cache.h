@@ -0,0 +1,66 @@
+#ifndef FILE_CACHE_H
+#define FILE_CACHE_H
+
+#include <stddef.h>
+#include <stdatomic.h>
+#include <time.h>
+#include "http_parser.h"
+
+#define FILE_CACHE_DEFAULT_SIZE (64 * 1024 * 1024)
+#define FILE_CACHE_MAX_FILE_SIZE (1024 * 1024)
+
+// Identify one version of a file, and one encoding of it, for conditional requests
+typedef struct {
+    // Strong ETag, quoted, made of the inode, size and modification time
+    char etag[80];
+    time_t mtime;
+} FileValidators;
+
+typedef struct FileCacheEntry {
+    char *path;
+    char *data;
+    size_t size;
+    const char *mime;
+    HttpContentEncoding encoding;
+    FileValidators validators;
+    // Precomputed header lines (Content-Type, Content-Encoding, Vary, Accept-Ranges, ETag, Last-Modified and
+    // Content-Length), each one terminated by CRLF
+    char *headers;
+    // Where the Content-Length line starts, ranged responses send the headers before it with their own length
+    size_t content_length_offset;
+    // Compressed versions of this entry, made when first asked for and dropped with it when the file changes
+    struct FileCacheEntry *variants[HTTP_ENCODING_COUNT];
+    // The cache holds one reference while the entry is indexed, each user of the entry holds another one
+    atomic_int refs;
+    struct FileCacheEntry *prev;
+    struct FileCacheEntry *next;
+} FileCacheEntry;
+
+// Enables the cache for files under root, using at most capacity bytes.
+// Changes under root are tracked with inotify by a background thread. Returns -1 on error.
+int file_cache_init(const char *root, size_t capacity);
+
+// Stops the inotify thread and drops every entry not in use
+void file_cache_shutdown(void);
+
+// Returns a referenced entry for path, loading it when the file is small enough to be cached.
+// Otherwise it returns NULL and *fd is an open descriptor for the file with *size bytes, or -1 if path is not a regular file.
+// The validators of the file are set in both cases.
+FileCacheEntry *file_cache_open(const char *path, int *fd, size_t *size, FileValidators *validators);
+
+// Returns a referenced variant of entry in one of the accepted encodings, a mask of 1 << HttpContentEncoding,
+// or NULL when the entry itself should be sent. A variant is read from the sibling file with the encoding's extension,
+// or compressed from the entry for the types of compress_eligible.
+FileCacheEntry *file_cache_variant(FileCacheEntry *entry, unsigned encodings);
+
+// Opens the precompressed sibling of path in the first accepted encoding that has one, for files that are not cached.
+// Returns -1 if there is none.
+int file_cache_open_sibling(const char *path, unsigned encodings, HttpContentEncoding *encoding, size_t *size);
+
+// Turns the validators of a file into the ones of its encoded version, which needs a different ETag
+void file_validators_encode(FileValidators *validators, HttpContentEncoding encoding);
+
+// Drops a reference returned by file_cache_open or file_cache_variant
+void file_cache_release(FileCacheEntry *entry);
+
+#endif //FILE_CACHE_H
@@ -53,6 +53,8 @@
               bear
               gdb
               ninja
+              zlib
+              brotli
             ];
           };
         }
@@ -0,0 +1,754 @@
+#define _GNU_SOURCE
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "http_parser.h"
+#include "scan.h"
+
+#define HTTP_HEADER_TABLE_BITS 6
+#define HTTP_HEADER_TABLE_SIZE (1 << HTTP_HEADER_TABLE_BITS)
+#define HTTP_HEADER_HASH_SEED 1676u
+
+// tchar from RFC 9110, indexed by byte
+static const unsigned char http_token_chars[256] = {
+    ['0' ... '9'] = 1, ['a' ... 'z'] = 1, ['A' ... 'Z'] = 1,
+    ['!'] = 1, ['#'] = 1, ['$'] = 1, ['%'] = 1, ['&'] = 1, ['\''] = 1, ['*'] = 1, ['+'] = 1,
+    ['-'] = 1, ['.'] = 1, ['^'] = 1, ['_'] = 1, ['`'] = 1, ['|'] = 1, ['~'] = 1,
+};
+
+static int http_is_token(const char *s, size_t length) {
+    if (length == 0) {
+        return 0;
+    }
+    for (size_t i = 0; i < length; i++) {
+        if (!http_token_chars[(unsigned char) s[i]]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int sv_equals(StringView a, StringView b) {
+    return a.length == b.length && 0 == memcmp(a.data, b.data, a.length);
+}
+
+int sv_equals_case(StringView a, StringView b) {
+    return a.length == b.length && 0 == strncasecmp(a.data, b.data, a.length);
+}
+
+int sv_contains_case(StringView haystack, StringView needle) {
+    for (size_t i = 0; i + needle.length <= haystack.length; i++) {
+        if (0 == strncasecmp(haystack.data + i, needle.data, needle.length)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+const StringView http_header_names[HTTP_HEADER_COUNT] = {
+    [HTTP_HEADER_HOST] = sv_cstr("Host"),
+    [HTTP_HEADER_CONNECTION] = sv_cstr("Connection"),
+    [HTTP_HEADER_KEEP_ALIVE] = sv_cstr("Keep-Alive"),
+    [HTTP_HEADER_CONTENT_LENGTH] = sv_cstr("Content-Length"),
+    [HTTP_HEADER_CONTENT_TYPE] = sv_cstr("Content-Type"),
+    [HTTP_HEADER_TRANSFER_ENCODING] = sv_cstr("Transfer-Encoding"),
+    [HTTP_HEADER_EXPECT] = sv_cstr("Expect"),
+    [HTTP_HEADER_ACCEPT] = sv_cstr("Accept"),
+    [HTTP_HEADER_ACCEPT_ENCODING] = sv_cstr("Accept-Encoding"),
+    [HTTP_HEADER_ACCEPT_RANGES] = sv_cstr("Accept-Ranges"),
+    [HTTP_HEADER_USER_AGENT] = sv_cstr("User-Agent"),
+    [HTTP_HEADER_COOKIE] = sv_cstr("Cookie"),
+    [HTTP_HEADER_REFERER] = sv_cstr("Referer"),
+    [HTTP_HEADER_AUTHORIZATION] = sv_cstr("Authorization"),
+    [HTTP_HEADER_CACHE_CONTROL] = sv_cstr("Cache-Control"),
+    [HTTP_HEADER_ETAG] = sv_cstr("ETag"),
+    [HTTP_HEADER_LAST_MODIFIED] = sv_cstr("Last-Modified"),
+    [HTTP_HEADER_IF_NONE_MATCH] = sv_cstr("If-None-Match"),
+    [HTTP_HEADER_IF_MODIFIED_SINCE] = sv_cstr("If-Modified-Since"),
+    [HTTP_HEADER_RANGE] = sv_cstr("Range"),
+    [HTTP_HEADER_IF_RANGE] = sv_cstr("If-Range"),
+    [HTTP_HEADER_CONTENT_RANGE] = sv_cstr("Content-Range"),
+    [HTTP_HEADER_CONTENT_ENCODING] = sv_cstr("Content-Encoding"),
+    [HTTP_HEADER_VARY] = sv_cstr("Vary"),
+    [HTTP_HEADER_DATE] = sv_cstr("Date"),
+    [HTTP_HEADER_SERVER] = sv_cstr("Server"),
+    [HTTP_HEADER_UPGRADE] = sv_cstr("Upgrade"),
+    [HTTP_HEADER_TE] = sv_cstr("TE"),
+    [HTTP_HEADER_TRAILER] = sv_cstr("Trailer"),
+    [HTTP_HEADER_LOCATION] = sv_cstr("Location"),
+    [HTTP_HEADER_ALLOW] = sv_cstr("Allow"),
+};
+
+// Perfect hash index for http_header_names: slot -> HttpHeaderId, 0 for empty slots.
+// HTTP_HEADER_HASH_SEED was chosen so no two names share a slot. When changing the names, generate both again with:
+//     gcc -DHTTP_GENERATE_HEADER_INDEX http_parser.c scan.c -o header_index && ./header_index
+static const unsigned char http_header_index[HTTP_HEADER_TABLE_SIZE] = {
+     16,  21,  14,   0,   0,   0,   0,  10,   5,   4,   0,  11,   0,   0,  20,  27,
+     23,   0,  30,  26,   0,   0,   0,  25,   8,   0,   9,   2,   0,  12,   0,   7,
+      0,   0,   1,  15,   0,   0,   0,   0,   0,   3,   0,  18,   0,   0,   0,   0,
+      0,  24,   0,  29,  19,   6,   0,   0,  13,   0,  22,   0,  17,  31,  28,   0,
+};
+
+// Packs the length with the first, middle and last bytes, which tell the known names apart, and takes the top bits
+// of a multiplication by an odd constant derived from the seed. Setting bit 5 lowercases letters and leaves '-' alone.
+static unsigned int http_header_hash(const char *name, size_t length, unsigned int seed) {
+    unsigned int key = ((unsigned int) length << 24) ^ (((unsigned char) name[0] | 0x20u) << 16)
+                     ^ (((unsigned char) name[length / 2] | 0x20u) << 8) ^ ((unsigned char) name[length - 1] | 0x20u);
+    return (key * (0x9e3779b1u + seed * 2)) >> (32 - HTTP_HEADER_TABLE_BITS);
+}
+
+static inline uint64_t http_load8(const char *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+HttpHeaderId http_header_id(const char *name, size_t length) {
+    if (length == 0) {
+        return HTTP_HEADER_OTHER;
+    }
+    HttpHeaderId id = http_header_index[http_header_hash(name, length, HTTP_HEADER_HASH_SEED)];
+    if (id == HTTP_HEADER_OTHER || http_header_names[id].length != length) {
+        return HTTP_HEADER_OTHER;
+    }
+    // Known names only have letters and '-', and a token can't hold the other byte that matches '-' once bit 5 is set.
+    // Longer names are compared 8 bytes at a time, the last load overlapping the previous one.
+    const char *known = http_header_names[id].data;
+    if (length >= 8) {
+        uint64_t differ = 0;
+        for (size_t i = 0; i + 8 < length; i += 8) {
+            differ |= (http_load8(name + i) ^ http_load8(known + i)) & ~0x2020202020202020ull;
+        }
+        differ |= (http_load8(name + length - 8) ^ http_load8(known + length - 8)) & ~0x2020202020202020ull;
+        return differ == 0 ? id : HTTP_HEADER_OTHER;
+    }
+    for (size_t i = 0; i < length; i++) {
+        if (((unsigned char) name[i] | 0x20) != ((unsigned char) known[i] | 0x20)) {
+            return HTTP_HEADER_OTHER;
+        }
+    }
+    return id;
+}
+
+StringView http_request_header(const HttpReq *req, StringView name) {
+    HttpHeaderId id = http_header_id(name.data, name.length);
+    if (id != HTTP_HEADER_OTHER) {
+        return http_request_known_header(req, id);
+    }
+    for (size_t i = 0; i < req->header_count; i++) {
+        if (sv_equals_case(req->headers[i].name, name)) {
+            return req->headers[i].value;
+        }
+    }
+    return (StringView) {0};
+}
+
+StringView http_request_known_header(const HttpReq *req, HttpHeaderId id) {
+    unsigned char position = req->known[id];
+    return position > 0 ? req->headers[position - 1].value : (StringView) {0};
+}
+
+const char *http_encoding_names[HTTP_ENCODING_COUNT] = {
+    [HTTP_ENCODING_GZIP] = "gzip",
+    [HTTP_ENCODING_BR] = "br",
+    [HTTP_ENCODING_ZSTD] = "zstd",
+};
+
+const char *http_encoding_extensions[HTTP_ENCODING_COUNT] = {
+    [HTTP_ENCODING_GZIP] = ".gz",
+    [HTTP_ENCODING_BR] = ".br",
+    [HTTP_ENCODING_ZSTD] = ".zst",
+};
+
+static StringView http_trim(const char *start, const char *end) {
+    while (start < end && (*start == ' ' || *start == '\t')) start++;
+    while (end > start && (end[-1] == ' ' || end[-1] == '\t')) end--;
+    return (StringView) {.data = start, .length = end - start};
+}
+
+// A qvalue is at most "1.000", it is zero when every digit is
+static int http_qvalue_zero(StringView q) {
+    for (size_t i = 0; i < q.length; i++) {
+        if (q.data[i] != '0' && q.data[i] != '.') {
+            return 0;
+        }
+    }
+    return q.length > 0;
+}
+
+unsigned http_accept_encodings(StringView value) {
+    unsigned listed = 0;
+    unsigned accepted = 0;
+    int wildcard = 0;
+    const char *end = value.data + value.length;
+    const char *p = value.data;
+    while (p < end) {
+        const char *element = p;
+        while (p < end && *p != ',') p++;
+        const char *params = memchr(element, ';', p - element);
+        StringView coding = http_trim(element, params != NULL ? params : p);
+        int refused = 0;
+        // Only the weight matters, it is the one parameter allowed here
+        if (params != NULL) {
+            StringView weight = http_trim(params + 1, p);
+            if (weight.length >= 2 && (weight.data[0] | 0x20) == 'q' && weight.data[1] == '=') {
+                refused = http_qvalue_zero(http_trim(weight.data + 2, weight.data + weight.length));
+            }
+        }
+        if (p < end) p++;
+        if (sv_equals(coding, sv_cstr("*"))) {
+            wildcard = !refused;
+            continue;
+        }
+        for (int encoding = HTTP_ENCODING_GZIP; encoding < HTTP_ENCODING_COUNT; encoding++) {
+            if (sv_equals_case(coding, (StringView) {.data = http_encoding_names[encoding], .length = strlen(http_encoding_names[encoding])})
+                || (encoding == HTTP_ENCODING_GZIP && sv_equals_case(coding, sv_cstr("x-gzip")))) {
+                listed |= 1u << encoding;
+                accepted |= refused ? 0 : 1u << encoding;
+            }
+        }
+    }
+    if (wildcard) {
+        accepted |= ~listed & (((1u << HTTP_ENCODING_COUNT) - 1) & ~(1u << HTTP_ENCODING_IDENTITY));
+    }
+    return accepted;
+}
+
+static const char *http_days[] = {"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"};
+static const char *http_months[] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+
+static int http_parse_digits(const char *s, int count) {
+    int value = 0;
+    for (int i = 0; i < count; i++) {
+        if (s[i] < '0' || s[i] > '9') {
+            return -1;
+        }
+        value = value * 10 + s[i] - '0';
+    }
+    return value;
+}
+
+int http_parse_date(StringView value, time_t *t) {
+    // "Sun, 06 Nov 1994 08:49:37 GMT"
+    const char *s = value.data;
+    if (value.length != HTTP_DATE_LENGTH || s[3] != ',' || s[4] != ' ' || s[7] != ' ' || s[11] != ' ' || s[16] != ' '
+        || s[19] != ':' || s[22] != ':' || 0 != memcmp(s + 25, " GMT", 4)) {
+        return -1;
+    }
+    int day = -1;
+    for (int i = 0; i < 7; i++) {
+        if (0 == memcmp(s, http_days[i], 3)) {
+            day = i;
+        }
+    }
+    struct tm tm = {.tm_mon = -1};
+    for (int i = 0; i < 12; i++) {
+        if (0 == memcmp(s + 8, http_months[i], 3)) {
+            tm.tm_mon = i;
+        }
+    }
+    tm.tm_mday = http_parse_digits(s + 5, 2);
+    tm.tm_year = http_parse_digits(s + 12, 4) - 1900;
+    tm.tm_hour = http_parse_digits(s + 17, 2);
+    tm.tm_min = http_parse_digits(s + 20, 2);
+    tm.tm_sec = http_parse_digits(s + 23, 2);
+    // timegm would normalize out of range fields into some other time, so they make the whole date invalid
+    if (day < 0 || tm.tm_mon < 0 || tm.tm_mday < 1 || tm.tm_mday > 31 || tm.tm_year < 0 || tm.tm_hour < 0 || tm.tm_hour > 23
+        || tm.tm_min < 0 || tm.tm_min > 59 || tm.tm_sec < 0 || tm.tm_sec > 60) {
+        return -1;
+    }
+    *t = timegm(&tm);
+    return 0;
+}
+
+int http_etag_matches(StringView list, StringView etag) {
+    const char *p = list.data;
+    const char *end = list.data + list.length;
+    while (p < end) {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == ',')) p++;
+        if (p == end) {
+            break;
+        }
+        if (*p == '*') {
+            return 1;
+        }
+        const char *tag = p;
+        if (end - p >= 2 && p[0] == 'W' && p[1] == '/') {
+            tag = p += 2;
+        }
+        // The opaque tag is quoted and may contain commas
+        if (p == end || *p != '"') {
+            return 0;
+        }
+        const char *close = memchr(p + 1, '"', end - p - 1);
+        if (close == NULL) {
+            return 0;
+        }
+        p = close + 1;
+        if (sv_equals((StringView) {.data = tag, .length = p - tag}, etag)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Parses the digits at *p, saturating at SIZE_MAX. Returns -1 if there are none.
+static int http_parse_position(const char **p, const char *end, size_t *value) {
+    const char *start = *p;
+    *value = 0;
+    for (; *p < end && **p >= '0' && **p <= '9'; (*p)++) {
+        size_t digit = **p - '0';
+        *value = *value > (SIZE_MAX - digit) / 10 ? SIZE_MAX : *value * 10 + digit;
+    }
+    return *p > start ? 0 : -1;
+}
+
+int http_parse_ranges(StringView value, size_t size, HttpRange ranges[HTTP_MAX_RANGES]) {
+    StringView unit = sv_cstr("bytes=");
+    if (value.length < unit.length || !sv_equals_case((StringView) {.data = value.data, .length = unit.length}, unit)) {
+        return -1;
+    }
+    const char *p = value.data + unit.length;
+    const char *end = value.data + value.length;
+    int count = 0;
+    int seen = 0;
+    while (p < end) {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == ',')) p++;
+        if (p == end) {
+            break;
+        }
+        if (++seen > HTTP_MAX_RANGES) {
+            return -1;
+        }
+        size_t first, last;
+        if (*p == '-') {
+            // The last bytes of the representation
+            p++;
+            if (http_parse_position(&p, end, &last) < 0) {
+                return -1;
+            }
+            if (last == 0 || size == 0) {
+                continue;
+            }
+            first = last < size ? size - last : 0;
+            last = size - 1;
+        }
+        else {
+            if (http_parse_position(&p, end, &first) < 0 || p == end || *p++ != '-') {
+                return -1;
+            }
+            if (http_parse_position(&p, end, &last) < 0) {
+                last = SIZE_MAX;
+            }
+            if (last < first) {
+                return -1;
+            }
+            if (first >= size) {
+                continue;
+            }
+            if (last >= size) {
+                last = size - 1;
+            }
+        }
+        while (p < end && (*p == ' ' || *p == '\t')) p++;
+        if (p < end && *p != ',') {
+            return -1;
+        }
+        ranges[count++] = (HttpRange) {.offset = first, .length = last - first + 1};
+    }
+    return seen > 0 ? count : -1;
+}
+
+StringView http_status_line(int status_code) {
+    switch (status_code) {
+        case 100: return sv_cstr("HTTP/1.1 100 Continue\r\n");
+        case 200: return sv_cstr("HTTP/1.1 200 OK\r\n");
+        case 204: return sv_cstr("HTTP/1.1 204 No Content\r\n");
+        case 206: return sv_cstr("HTTP/1.1 206 Partial Content\r\n");
+        case 301: return sv_cstr("HTTP/1.1 301 Moved Permanently\r\n");
+        case 304: return sv_cstr("HTTP/1.1 304 Not Modified\r\n");
+        case 400: return sv_cstr("HTTP/1.1 400 Bad Request\r\n");
+        case 403: return sv_cstr("HTTP/1.1 403 Forbidden\r\n");
+        case 404: return sv_cstr("HTTP/1.1 404 Not Found\r\n");
+        case 405: return sv_cstr("HTTP/1.1 405 Method Not Allowed\r\n");
+        case 408: return sv_cstr("HTTP/1.1 408 Request Timeout\r\n");
+        case 411: return sv_cstr("HTTP/1.1 411 Length Required\r\n");
+        case 412: return sv_cstr("HTTP/1.1 412 Precondition Failed\r\n");
+        case 413: return sv_cstr("HTTP/1.1 413 Content Too Large\r\n");
+        case 414: return sv_cstr("HTTP/1.1 414 URI Too Long\r\n");
+        case 416: return sv_cstr("HTTP/1.1 416 Range Not Satisfiable\r\n");
+        case 417: return sv_cstr("HTTP/1.1 417 Expectation Failed\r\n");
+        case 431: return sv_cstr("HTTP/1.1 431 Request Header Fields Too Large\r\n");
+        case 500: return sv_cstr("HTTP/1.1 500 Internal Server Error\r\n");
+        case 501: return sv_cstr("HTTP/1.1 501 Not Implemented\r\n");
+        case 503: return sv_cstr("HTTP/1.1 503 Service Unavailable\r\n");
+        case 505: return sv_cstr("HTTP/1.1 505 HTTP Version Not Supported\r\n");
+        default: return (StringView) {0};
+    }
+}
+
+// "00" to "99", so the digits are written two at a time
+static const char http_digit_pairs[] =
+    "0001020304050607080910111213141516171819"
+    "2021222324252627282930313233343536373839"
+    "4041424344454647484950515253545556575859"
+    "6061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+size_t http_format_size(char *out, size_t value) {
+    char digits[HTTP_SIZE_DIGITS];
+    char *p = digits + sizeof(digits);
+    while (value >= 100) {
+        p -= 2;
+        memcpy(p, http_digit_pairs + (value % 100) * 2, 2);
+        value /= 100;
+    }
+    if (value >= 10) {
+        p -= 2;
+        memcpy(p, http_digit_pairs + value * 2, 2);
+    }
+    else {
+        *--p = '0' + value;
+    }
+    size_t length = digits + sizeof(digits) - p;
+    memcpy(out, p, length);
+    return length;
+}
+
+static char *http_put_pair(char *out, int value) {
+    memcpy(out, http_digit_pairs + value * 2, 2);
+    return out + 2;
+}
+
+// Dates are formatted without strftime, so the locale can't change them
+void http_format_date(char *out, time_t t) {
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    int year = (tm.tm_year + 1900) % 10000;
+    char *p = out;
+    memcpy(p, http_days[tm.tm_wday], 3);
+    p = memcpy(p + 3, ", ", 2) + 2;
+    p = http_put_pair(p, tm.tm_mday);
+    *p++ = ' ';
+    p = memcpy(p, http_months[tm.tm_mon], 3) + 3;
+    *p++ = ' ';
+    p = http_put_pair(http_put_pair(p, year / 100), year % 100);
+    *p++ = ' ';
+    p = http_put_pair(p, tm.tm_hour);
+    *p++ = ':';
+    p = http_put_pair(p, tm.tm_min);
+    *p++ = ':';
+    p = http_put_pair(p, tm.tm_sec);
+    memcpy(p, " GMT", 5);
+}
+
+void http_parser_reset(HttpParser *parser) {
+    parser->status = HTTP_PARSE_INCOMPLETE;
+    parser->offset = 0;
+    parser->scanned = 0;
+    parser->in_headers = 0;
+    parser->header_count = 0;
+    parser->has_content_length = 0;
+    parser->chunked = 0;
+    parser->header_length = 0;
+    parser->content_length = 0;
+}
+
+static HttpParseStatus http_parse_request_line(HttpParser *parser, const char *buffer, size_t start, size_t end) {
+    const char *line = buffer + start;
+    const char *first = scan_find(line, buffer + end, ' ');
+    const char *last = memrchr(line, ' ', end - start);
+    if (first == NULL || first == last || first == line || last + 1 == buffer + end) {
+        return HTTP_PARSE_INVALID;
+    }
+    parser->method = (HttpSlice) {.offset = start, .length = first - line};
+    parser->path = (HttpSlice) {.offset = first + 1 - buffer, .length = last - first - 1};
+    parser->version = (HttpSlice) {.offset = last + 1 - buffer, .length = buffer + end - last - 1};
+    if (!http_is_token(line, parser->method.length) || parser->path.length == 0 || memchr(first + 1, ' ', parser->path.length) != NULL
+        || parser->version.length < 5 || 0 != memcmp(last + 1, "HTTP/", 5)) {
+        return HTTP_PARSE_INVALID;
+    }
+    return HTTP_PARSE_INCOMPLETE;
+}
+
+static HttpParseStatus http_parse_content_length(HttpParser *parser, const char *value, size_t length) {
+    if (length == 0) {
+        return HTTP_PARSE_INVALID;
+    }
+    size_t content_length = 0;
+    for (size_t i = 0; i < length; i++) {
+        if (value[i] < '0' || value[i] > '9' || content_length > (SIZE_MAX - 9) / 10) {
+            return HTTP_PARSE_INVALID;
+        }
+        content_length = content_length * 10 + (value[i] - '0');
+    }
+    if (parser->has_content_length && parser->content_length != content_length) {
+        return HTTP_PARSE_INVALID;
+    }
+    parser->has_content_length = 1;
+    parser->content_length = content_length;
+    return HTTP_PARSE_INCOMPLETE;
+}
+
+// Only bodies whose final coding is chunked can be framed, as RFC 9112 requires
+static HttpParseStatus http_parse_transfer_encoding(HttpParser *parser, const char *value, size_t length) {
+    StringView chunked = sv_cstr("chunked");
+    if (length < chunked.length || !sv_equals_case((StringView) {.data = value + length - chunked.length, .length = chunked.length}, chunked)) {
+        return HTTP_PARSE_INVALID;
+    }
+    size_t i = length - chunked.length;
+    while (i > 0 && (value[i - 1] == ' ' || value[i - 1] == '\t')) i--;
+    if (i > 0 && value[i - 1] != ',') {
+        return HTTP_PARSE_INVALID;
+    }
+    parser->chunked = 1;
+    return HTTP_PARSE_INCOMPLETE;
+}
+
+static HttpParseStatus http_parse_header_line(HttpParser *parser, const char *buffer, size_t start, size_t end) {
+    const char *line = buffer + start;
+    const char *colon = scan_find(line, buffer + end, ':');
+    // Obsolete line folding is rejected, as RFC 9112 allows
+    if (colon == NULL || line[0] == ' ' || line[0] == '\t' || !http_is_token(line, colon - line)) {
+        return HTTP_PARSE_INVALID;
+    }
+    if (parser->header_count == HTTP_MAX_HEADERS) {
+        return HTTP_PARSE_TOO_LARGE;
+    }
+    size_t value_start = colon + 1 - buffer;
+    size_t value_end = end;
+    while (value_start < value_end && (buffer[value_start] == ' ' || buffer[value_start] == '\t')) value_start++;
+    while (value_end > value_start && (buffer[value_end - 1] == ' ' || buffer[value_end - 1] == '\t')) value_end--;
+
+    size_t i = parser->header_count++;
+    parser->names[i] = (HttpSlice) {.offset = start, .length = colon - line};
+    parser->values[i] = (HttpSlice) {.offset = value_start, .length = value_end - value_start};
+    parser->ids[i] = http_header_id(line, colon - line);
+    switch (parser->ids[i]) {
+        case HTTP_HEADER_CONTENT_LENGTH:
+            return http_parse_content_length(parser, buffer + value_start, value_end - value_start);
+        case HTTP_HEADER_TRANSFER_ENCODING:
+            return http_parse_transfer_encoding(parser, buffer + value_start, value_end - value_start);
+        default:
+            return HTTP_PARSE_INCOMPLETE;
+    }
+}
+
+HttpParseStatus http_parser_execute(HttpParser *parser, const char *buffer, size_t length) {
+    while (parser->status == HTTP_PARSE_INCOMPLETE) {
+        size_t from = parser->scanned > parser->offset ? parser->scanned : parser->offset;
+        // The colon of a header line is only looked for once the line is complete, a second memchr over a line
+        // that is already in cache costs less than a scan for either byte
+        const char *newline = scan_find(buffer + from, buffer + length, '\n');
+        if (newline == NULL) {
+            parser->scanned = length;
+            if (length > HTTP_MAX_HEADER_SIZE) {
+                parser->status = HTTP_PARSE_TOO_LARGE;
+            }
+            break;
+        }
+        size_t start = parser->offset;
+        size_t end = newline - buffer;
+        parser->offset = end + 1;
+        if (parser->offset > HTTP_MAX_HEADER_SIZE) {
+            parser->status = HTTP_PARSE_TOO_LARGE;
+            break;
+        }
+        // Lines end with CRLF, but a bare LF is accepted as well
+        if (end > start && buffer[end - 1] == '\r') {
+            end--;
+        }
+        if (!parser->in_headers) {
+            if (end == start) {
+                continue; // Empty lines before the request line are ignored
+            }
+            parser->status = http_parse_request_line(parser, buffer, start, end);
+            parser->in_headers = 1;
+        }
+        else if (end == start) {
+            parser->header_length = parser->offset;
+            // A message with both framings could be read differently by a proxy in front of the server
+            parser->status = parser->chunked && parser->has_content_length ? HTTP_PARSE_INVALID : HTTP_PARSE_DONE;
+        }
+        else {
+            parser->status = http_parse_header_line(parser, buffer, start, end);
+        }
+    }
+    return parser->status;
+}
+
+HttpReq *http_parser_request(HttpParser *parser, const char *buffer) {
+    HttpReq *req = &parser->req;
+    req->method = (StringView) {.data = buffer + parser->method.offset, .length = parser->method.length};
+    req->path = (StringView) {.data = buffer + parser->path.offset, .length = parser->path.length};
+    req->version = (StringView) {.data = buffer + parser->version.offset, .length = parser->version.length};
+    memset(req->known, 0, sizeof(req->known));
+    for (size_t i = 0; i < parser->header_count; i++) {
+        req->headers[i].name = (StringView) {.data = buffer + parser->names[i].offset, .length = parser->names[i].length};
+        req->headers[i].value = (StringView) {.data = buffer + parser->values[i].offset, .length = parser->values[i].length};
+        req->headers[i].id = parser->ids[i];
+        if (req->known[parser->ids[i]] == 0) {
+            req->known[parser->ids[i]] = i + 1;
+        }
+    }
+    req->header_count = parser->header_count;
+    req->body = (StringView) {0};
+    req->body_fd = -1;
+    return req;
+}
+
+void http_chunked_reset(HttpChunkedDecoder *decoder) {
+    decoder->status = HTTP_PARSE_INCOMPLETE;
+    decoder->state = HTTP_CHUNK_SIZE;
+    decoder->size = 0;
+    decoder->digits = 0;
+    decoder->skipped = 0;
+}
+
+static int http_hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+size_t http_chunked_decode(HttpChunkedDecoder *decoder, char *data, size_t length, size_t *consumed) {
+    size_t in = 0;
+    size_t out = 0;
+    while (in < length && decoder->status == HTTP_PARSE_INCOMPLETE) {
+        char c = data[in];
+        switch (decoder->state) {
+            case HTTP_CHUNK_SIZE: {
+                int digit = http_hex_value(c);
+                if (digit >= 0) {
+                    if (decoder->size > (SIZE_MAX >> 4)) {
+                        decoder->status = HTTP_PARSE_TOO_LARGE;
+                        break;
+                    }
+                    decoder->size = (decoder->size << 4) | digit;
+                    decoder->digits++;
+                }
+                else if (decoder->digits == 0) {
+                    decoder->status = HTTP_PARSE_INVALID;
+                }
+                else if (c == ';' || c == ' ' || c == '\t') {
+                    decoder->state = HTTP_CHUNK_EXTENSION;
+                }
+                else if (c == '\r') {
+                    decoder->state = HTTP_CHUNK_SIZE_LF;
+                }
+                else if (c == '\n') {
+                    decoder->state = decoder->size > 0 ? HTTP_CHUNK_DATA : HTTP_CHUNK_TRAILER_START;
+                }
+                else {
+                    decoder->status = HTTP_PARSE_INVALID;
+                }
+                in++;
+                break;
+            }
+            case HTTP_CHUNK_EXTENSION: {
+                const char *newline = memchr(data + in, '\n', length - in);
+                size_t skip = newline != NULL ? (size_t) (newline - data - in) : length - in;
+                decoder->skipped += skip;
+                in += skip;
+                if (decoder->skipped > HTTP_MAX_HEADER_SIZE) {
+                    decoder->status = HTTP_PARSE_TOO_LARGE;
+                }
+                else if (newline != NULL) {
+                    in++;
+                    decoder->state = decoder->size > 0 ? HTTP_CHUNK_DATA : HTTP_CHUNK_TRAILER_START;
+                }
+                break;
+            }
+            case HTTP_CHUNK_SIZE_LF:
+                if (c != '\n') {
+                    decoder->status = HTTP_PARSE_INVALID;
+                    break;
+                }
+                in++;
+                decoder->state = decoder->size > 0 ? HTTP_CHUNK_DATA : HTTP_CHUNK_TRAILER_START;
+                break;
+            case HTTP_CHUNK_DATA: {
+                size_t n = length - in < decoder->size ? length - in : decoder->size;
+                memmove(data + out, data + in, n);
+                in += n;
+                out += n;
+                decoder->size -= n;
+                if (decoder->size == 0) {
+                    decoder->state = HTTP_CHUNK_DATA_CR;
+                }
+                break;
+            }
+            case HTTP_CHUNK_DATA_CR:
+            case HTTP_CHUNK_DATA_LF:
+                if (c == '\r' && decoder->state == HTTP_CHUNK_DATA_CR) {
+                    decoder->state = HTTP_CHUNK_DATA_LF;
+                }
+                else if (c == '\n') {
+                    decoder->state = HTTP_CHUNK_SIZE;
+                    decoder->digits = 0;
+                }
+                else {
+                    decoder->status = HTTP_PARSE_INVALID;
+                }
+                in++;
+                break;
+            case HTTP_CHUNK_TRAILER_START:
+                if (c == '\r') {
+                    decoder->state = HTTP_CHUNK_TRAILER_LF;
+                    in++;
+                    break;
+                }
+                if (c == '\n') {
+                    decoder->status = HTTP_PARSE_DONE;
+                    in++;
+                    break;
+                }
+                decoder->state = HTTP_CHUNK_TRAILER;
+                // fall through
+            case HTTP_CHUNK_TRAILER: {
+                // Trailer fields are not used, so they are only skipped
+                const char *newline = memchr(data + in, '\n', length - in);
+                size_t skip = newline != NULL ? (size_t) (newline - data - in) + 1 : length - in;
+                decoder->skipped += skip;
+                in += skip;
+                if (decoder->skipped > HTTP_MAX_HEADER_SIZE) {
+                    decoder->status = HTTP_PARSE_TOO_LARGE;
+                }
+                else if (newline != NULL) {
+                    decoder->state = HTTP_CHUNK_TRAILER_START;
+                }
+                break;
+            }
+            case HTTP_CHUNK_TRAILER_LF:
+                decoder->status = c == '\n' ? HTTP_PARSE_DONE : HTTP_PARSE_INVALID;
+                in++;
+                break;
+        }
+    }
+    *consumed = in;
+    return out;
+}
+
+#ifdef HTTP_GENERATE_HEADER_INDEX
+int main() {
+    for (unsigned int seed = 0; seed < 1000000; seed++) {
+        unsigned char index[HTTP_HEADER_TABLE_SIZE] = {0};
+        int id = 1;
+        for (; id < HTTP_HEADER_COUNT; id++) {
+            unsigned int slot = http_header_hash(http_header_names[id].data, http_header_names[id].length, seed);
+            if (index[slot] != 0) break;
+            index[slot] = id;
+        }
+        if (id < HTTP_HEADER_COUNT) continue;
+        printf("#define HTTP_HEADER_HASH_SEED %uu\n", seed);
+        for (int i = 0; i < HTTP_HEADER_TABLE_SIZE; i++) {
+            printf("%s%3d,%s", i % 16 == 0 ? "    " : "", index[i], i % 16 == 15 ? "\n" : " ");
+        }
+        return 0;
+    }
+    fprintf(stderr, "No seed found, increase HTTP_HEADER_TABLE_SIZE\n");
+    return 1;
+}
+#endif //HTTP_GENERATE_HEADER_INDEX
@@ -0,0 +1,213 @@
+#ifndef HTTP_PARSER_H
+#define HTTP_PARSER_H
+
+#include <stddef.h>
+#include <time.h>
+
+#define HTTP_MAX_HEADER_SIZE (16 * 1024)
+#define HTTP_MAX_HEADERS 64
+// Enough room for any size_t written by http_format_size
+#define HTTP_SIZE_DIGITS 20
+// Length of an IMF-fixdate, as in "Sun, 06 Nov 1994 08:49:37 GMT"
+#define HTTP_DATE_LENGTH 29
+// Range headers asking for more ranges are ignored
+#define HTTP_MAX_RANGES 16
+
+typedef struct {
+    const char *data;
+    size_t length;
+} StringView;
+
+// Header names the server knows about, recognized once while parsing. HTTP_HEADER_OTHER is any other name.
+typedef enum {
+    HTTP_HEADER_OTHER,
+    HTTP_HEADER_HOST,
+    HTTP_HEADER_CONNECTION,
+    HTTP_HEADER_KEEP_ALIVE,
+    HTTP_HEADER_CONTENT_LENGTH,
+    HTTP_HEADER_CONTENT_TYPE,
+    HTTP_HEADER_TRANSFER_ENCODING,
+    HTTP_HEADER_EXPECT,
+    HTTP_HEADER_ACCEPT,
+    HTTP_HEADER_ACCEPT_ENCODING,
+    HTTP_HEADER_ACCEPT_RANGES,
+    HTTP_HEADER_USER_AGENT,
+    HTTP_HEADER_COOKIE,
+    HTTP_HEADER_REFERER,
+    HTTP_HEADER_AUTHORIZATION,
+    HTTP_HEADER_CACHE_CONTROL,
+    HTTP_HEADER_ETAG,
+    HTTP_HEADER_LAST_MODIFIED,
+    HTTP_HEADER_IF_NONE_MATCH,
+    HTTP_HEADER_IF_MODIFIED_SINCE,
+    HTTP_HEADER_RANGE,
+    HTTP_HEADER_IF_RANGE,
+    HTTP_HEADER_CONTENT_RANGE,
+    HTTP_HEADER_CONTENT_ENCODING,
+    HTTP_HEADER_VARY,
+    HTTP_HEADER_DATE,
+    HTTP_HEADER_SERVER,
+    HTTP_HEADER_UPGRADE,
+    HTTP_HEADER_TE,
+    HTTP_HEADER_TRAILER,
+    HTTP_HEADER_LOCATION,
+    HTTP_HEADER_ALLOW,
+    HTTP_HEADER_COUNT,
+} HttpHeaderId;
+
+typedef struct {
+    StringView name;
+    StringView value;
+    HttpHeaderId id;
+} HttpHeaderView;
+
+// Content codings the server can send, HTTP_ENCODING_IDENTITY is the file as it is
+typedef enum {
+    HTTP_ENCODING_IDENTITY,
+    HTTP_ENCODING_GZIP,
+    HTTP_ENCODING_BR,
+    HTTP_ENCODING_ZSTD,
+    HTTP_ENCODING_COUNT,
+} HttpContentEncoding;
+
+// Every view points into the buffer given to http_parser_request
+typedef struct {
+    StringView method;
+    StringView path;
+    StringView version;
+    HttpHeaderView headers[HTTP_MAX_HEADERS];
+    size_t header_count;
+    // Position + 1 in headers of the first header with each known name, 0 when it is missing
+    unsigned char known[HTTP_HEADER_COUNT];
+    // Filled in by the caller once the body is read, body.data is NULL when it was spilled to body_fd
+    StringView body;
+    int body_fd;
+} HttpReq;
+
+// A satisfiable byte range, clamped to the size of the representation
+typedef struct {
+    size_t offset;
+    size_t length;
+} HttpRange;
+
+typedef enum {
+    HTTP_PARSE_INCOMPLETE,
+    HTTP_PARSE_DONE,
+    HTTP_PARSE_INVALID,
+    HTTP_PARSE_TOO_LARGE,
+} HttpParseStatus;
+
+// Offsets into the receive buffer, which can move while a request is being received
+typedef struct {
+    size_t offset;
+    size_t length;
+} HttpSlice;
+
+typedef struct {
+    HttpParseStatus status;
+    // Start of the next line to be parsed, and how far the search for its end already went
+    size_t offset;
+    size_t scanned;
+    int in_headers;
+    HttpSlice method;
+    HttpSlice path;
+    HttpSlice version;
+    HttpSlice names[HTTP_MAX_HEADERS];
+    HttpSlice values[HTTP_MAX_HEADERS];
+    unsigned char ids[HTTP_MAX_HEADERS];
+    size_t header_count;
+    int has_content_length;
+    int chunked;
+    // Set once the status is HTTP_PARSE_DONE
+    size_t header_length;
+    size_t content_length;
+    HttpReq req;
+} HttpParser;
+
+typedef enum {
+    HTTP_CHUNK_SIZE,
+    HTTP_CHUNK_EXTENSION,
+    HTTP_CHUNK_SIZE_LF,
+    HTTP_CHUNK_DATA,
+    HTTP_CHUNK_DATA_CR,
+    HTTP_CHUNK_DATA_LF,
+    HTTP_CHUNK_TRAILER_START,
+    HTTP_CHUNK_TRAILER,
+    HTTP_CHUNK_TRAILER_LF,
+} HttpChunkState;
+
+typedef struct {
+    HttpParseStatus status;
+    HttpChunkState state;
+    // Size of the chunk being read, or the bytes of it still missing once its data started
+    size_t size;
+    size_t digits;
+    // Bytes of chunk extensions and trailers seen, which are skipped
+    size_t skipped;
+} HttpChunkedDecoder;
+
+#define sv_cstr(s) ((StringView) {.data = (s), .length = sizeof(s) - 1})
+
+// Canonical spelling of every known header name, the data is NUL terminated
+extern const StringView http_header_names[HTTP_HEADER_COUNT];
+
+// Returns the known header with this name, ignoring case, or HTTP_HEADER_OTHER
+HttpHeaderId http_header_id(const char *name, size_t length);
+
+// Content-Encoding value and file extension of each coding, NULL for the identity
+extern const char *http_encoding_names[HTTP_ENCODING_COUNT];
+extern const char *http_encoding_extensions[HTTP_ENCODING_COUNT];
+
+// Returns the codings an Accept-Encoding value allows as a mask of 1 << HttpContentEncoding, leaving out the identity.
+// Codings with q=0 are refused and "*" stands for every coding not listed.
+unsigned http_accept_encodings(StringView value);
+
+// Returns "HTTP/1.1 <code> <reason>\r\n" for the status codes the server sends, or a view with NULL data
+StringView http_status_line(int status_code);
+
+// Writes value in decimal to out, which needs HTTP_SIZE_DIGITS bytes, and returns the number of digits.
+// No NUL terminator is written.
+size_t http_format_size(char *out, size_t value);
+
+// Writes t as an IMF-fixdate to out, which needs HTTP_DATE_LENGTH + 1 bytes, and NUL terminates it
+void http_format_date(char *out, time_t t);
+
+// Parses an IMF-fixdate. The obsolete RFC 850 and asctime formats are not accepted. Returns -1 if value is not a date.
+int http_parse_date(StringView value, time_t *t);
+
+// Returns a non-zero value if the If-None-Match list contains etag, using the weak comparison. "*" matches any etag.
+int http_etag_matches(StringView list, StringView etag);
+
+// Parses a bytes Range value for a representation of size bytes, leaving out the ranges that start past its end.
+// Returns the number of ranges stored in ranges, 0 if none is satisfiable, or -1 if the value is invalid, uses another
+// unit or has more than HTTP_MAX_RANGES ranges, in which case the header should be ignored.
+int http_parse_ranges(StringView value, size_t size, HttpRange ranges[HTTP_MAX_RANGES]);
+
+void http_parser_reset(HttpParser *parser);
+
+// Parses the request head in buffer, resuming where the previous call stopped.
+// The buffer must keep the bytes already seen, but it may have moved and grown since the last call.
+HttpParseStatus http_parser_execute(HttpParser *parser, const char *buffer, size_t length);
+
+// Returns the parsed request with its views pointing into buffer
+HttpReq *http_parser_request(HttpParser *parser, const char *buffer);
+
+void http_chunked_reset(HttpChunkedDecoder *decoder);
+
+// Decodes a chunked body in place: the chunk data found in the first length bytes is moved to the start of data.
+// Returns how many bytes of data were decoded and sets *consumed to the number of input bytes used.
+// The decoder status becomes HTTP_PARSE_DONE after the last chunk and its trailers.
+size_t http_chunked_decode(HttpChunkedDecoder *decoder, char *data, size_t length, size_t *consumed);
+
+// Returns a case-insensitive match for the header value, or a view with NULL data if the header is missing
+StringView http_request_header(const HttpReq *req, StringView name);
+
+// Same as http_request_header for a known header, without comparing names
+StringView http_request_known_header(const HttpReq *req, HttpHeaderId id);
+
+int sv_equals(StringView a, StringView b);
+int sv_equals_case(StringView a, StringView b);
+// Returns a non-zero value if needle appears in haystack, ignoring case
+int sv_contains_case(StringView haystack, StringView needle);
+
+#endif //HTTP_PARSER_H
@@ -0,0 +1,71 @@
+#include <string.h>
+#include "input_buffer.h"
+#include "bfutils_vector.h"
+
+void input_buffer_init(InputBuffer *buf) {
+    buf->data = NULL;
+    buf->start = 0;
+}
+
+void input_buffer_free(InputBuffer *buf) {
+    vector_free(buf->data);
+    buf->start = 0;
+}
+
+char *input_buffer_data(InputBuffer *buf) {
+    return buf->data + buf->start;
+}
+
+size_t input_buffer_length(InputBuffer *buf) {
+    return vector_length(buf->data) - buf->start;
+}
+
+char *input_buffer_reserve(InputBuffer *buf, size_t min_free, size_t *available) {
+    size_t end = vector_length(buf->data);
+    size_t length = end - buf->start;
+    if (vector_capacity(buf->data) - end < min_free) {
+        size_t capacity = vector_capacity(buf->data);
+        // Only move the bytes down without growing when that moves no more than the space it wins back
+        if (length > buf->start || capacity - length < min_free) {
+            capacity = capacity * 2 > length + min_free ? capacity * 2 : length + min_free;
+        }
+        if (buf->start > 0) {
+            memmove(buf->data, buf->data + buf->start, length);
+            vector_header(buf->data)->length = length;
+            buf->start = 0;
+        }
+        vector_ensure_capacity(buf->data, capacity);
+        end = length;
+    }
+    *available = vector_capacity(buf->data) - end;
+    return buf->data + end;
+}
+
+void input_buffer_commit(InputBuffer *buf, size_t length) {
+    vector_header(buf->data)->length += length;
+}
+
+void input_buffer_append(InputBuffer *buf, const char *data, size_t length) {
+    size_t available;
+    char *space = input_buffer_reserve(buf, length, &available);
+    memcpy(space, data, length);
+    input_buffer_commit(buf, length);
+}
+
+void input_buffer_consume(InputBuffer *buf, size_t length) {
+    buf->start += length;
+    if (buf->data != NULL && buf->start == vector_length(buf->data)) {
+        vector_header(buf->data)->length = 0;
+        buf->start = 0;
+    }
+}
+
+void input_buffer_erase(InputBuffer *buf, size_t offset, size_t length) {
+    if (length == 0) {
+        return;
+    }
+    char *data = input_buffer_data(buf);
+    size_t tail = input_buffer_length(buf) - offset - length;
+    memmove(data + offset, data + offset + length, tail);
+    vector_header(buf->data)->length -= length;
+}
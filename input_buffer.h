@@ -0,0 +1,33 @@
+#ifndef INPUT_BUFFER_H
+#define INPUT_BUFFER_H
+
+#include <stddef.h>
+
+// Bytes received on a connection and not consumed yet, stored contiguously so requests can be parsed in place.
+// Consuming from the front only moves an offset, the bytes are moved down when the space is needed again.
+typedef struct {
+    char *data;
+    size_t start;
+} InputBuffer;
+
+void input_buffer_init(InputBuffer *buf);
+void input_buffer_free(InputBuffer *buf);
+
+char *input_buffer_data(InputBuffer *buf);
+size_t input_buffer_length(InputBuffer *buf);
+
+// Returns the free space after the buffered bytes, which has at least min_free bytes. Data pointers obtained before are invalidated.
+char *input_buffer_reserve(InputBuffer *buf, size_t min_free, size_t *available);
+
+// Marks length bytes written to the reserved space as buffered
+void input_buffer_commit(InputBuffer *buf, size_t length);
+
+void input_buffer_append(InputBuffer *buf, const char *data, size_t length);
+
+// Drops length bytes from the front
+void input_buffer_consume(InputBuffer *buf, size_t length);
+
+// Drops length bytes starting offset bytes after the front
+void input_buffer_erase(InputBuffer *buf, size_t offset, size_t length);
+
+#endif //INPUT_BUFFER_H
@@ -0,0 +1,333 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "mime.h"
+#include "arena.h"
+#ifdef MIME_GENERATE_INDEX
+#define BFUTILS_VECTOR_IMPLEMENTATION
+#define BFUTILS_HASHMAP_IMPLEMENTATION
+#define BFUTILS_PROCESS_IMPLEMENTATION
+#endif //MIME_GENERATE_INDEX
+#include "bfutils_vector.h"
+#include "bfutils_hash.h"
+#include "bfutils_process.h"
+
+#define MIME_TABLE_SIZE 512
+#define MIME_HASH_SEED 691u
+#define MIME_SNIFF_CACHE_MAX 4096
+
+typedef struct {
+    const char *ext;
+    const char *type;
+} MimeType;
+
+typedef struct {
+    char *key;
+    char *value;
+} MimeEntry;
+
+static const MimeType mime_types[] = {
+    {"html",        "text/html; charset=utf-8"},
+    {"htm",         "text/html; charset=utf-8"},
+    {"css",         "text/css; charset=utf-8"},
+    {"js",          "text/javascript; charset=utf-8"},
+    {"mjs",         "text/javascript; charset=utf-8"},
+    {"json",        "application/json"},
+    {"map",         "application/json"},
+    {"jsonld",      "application/ld+json"},
+    {"webmanifest", "application/manifest+json"},
+    {"xml",         "application/xml"},
+    {"xhtml",       "application/xhtml+xml"},
+    {"txt",         "text/plain; charset=utf-8"},
+    {"md",          "text/markdown; charset=utf-8"},
+    {"csv",         "text/csv; charset=utf-8"},
+    {"ics",         "text/calendar; charset=utf-8"},
+    {"vtt",         "text/vtt; charset=utf-8"},
+    {"wasm",        "application/wasm"},
+    {"pdf",         "application/pdf"},
+    {"zip",         "application/zip"},
+    {"gz",          "application/gzip"},
+    {"tgz",         "application/gzip"},
+    {"br",          "application/x-brotli"},
+    {"zst",         "application/zstd"},
+    {"bz2",         "application/x-bzip2"},
+    {"xz",          "application/x-xz"},
+    {"tar",         "application/x-tar"},
+    {"7z",          "application/x-7z-compressed"},
+    {"rar",         "application/vnd.rar"},
+    {"jar",         "application/java-archive"},
+    {"bin",         "application/octet-stream"},
+    {"exe",         "application/octet-stream"},
+    {"iso",         "application/octet-stream"},
+    {"dmg",         "application/octet-stream"},
+    {"deb",         "application/vnd.debian.binary-package"},
+    {"rpm",         "application/x-rpm"},
+    {"doc",         "application/msword"},
+    {"docx",        "application/vnd.openxmlformats-officedocument.wordprocessingml.document"},
+    {"xls",         "application/vnd.ms-excel"},
+    {"xlsx",        "application/vnd.openxmlformats-officedocument.spreadsheetml.sheet"},
+    {"ppt",         "application/vnd.ms-powerpoint"},
+    {"pptx",        "application/vnd.openxmlformats-officedocument.presentationml.presentation"},
+    {"odt",         "application/vnd.oasis.opendocument.text"},
+    {"ods",         "application/vnd.oasis.opendocument.spreadsheet"},
+    {"rtf",         "application/rtf"},
+    {"epub",        "application/epub+zip"},
+    {"rss",         "application/rss+xml"},
+    {"atom",        "application/atom+xml"},
+    {"sh",          "application/x-sh"},
+    {"png",         "image/png"},
+    {"jpg",         "image/jpeg"},
+    {"jpeg",        "image/jpeg"},
+    {"gif",         "image/gif"},
+    {"webp",        "image/webp"},
+    {"avif",        "image/avif"},
+    {"svg",         "image/svg+xml"},
+    {"ico",         "image/vnd.microsoft.icon"},
+    {"bmp",         "image/bmp"},
+    {"tif",         "image/tiff"},
+    {"tiff",        "image/tiff"},
+    {"apng",        "image/apng"},
+    {"woff",        "font/woff"},
+    {"woff2",       "font/woff2"},
+    {"ttf",         "font/ttf"},
+    {"otf",         "font/otf"},
+    {"eot",         "application/vnd.ms-fontobject"},
+    {"mp3",         "audio/mpeg"},
+    {"ogg",         "audio/ogg"},
+    {"oga",         "audio/ogg"},
+    {"opus",        "audio/opus"},
+    {"wav",         "audio/wav"},
+    {"flac",        "audio/flac"},
+    {"aac",         "audio/aac"},
+    {"m4a",         "audio/mp4"},
+    {"weba",        "audio/webm"},
+    {"mid",         "audio/midi"},
+    {"midi",        "audio/midi"},
+    {"mp4",         "video/mp4"},
+    {"m4v",         "video/mp4"},
+    {"webm",        "video/webm"},
+    {"ogv",         "video/ogg"},
+    {"mov",         "video/quicktime"},
+    {"avi",         "video/x-msvideo"},
+    {"mkv",         "video/x-matroska"},
+    {"mpeg",        "video/mpeg"},
+    {"ts",          "video/mp2t"},
+    {"m3u8",        "application/vnd.apple.mpegurl"},
+};
+
+// Perfect hash index for mime_types: slot -> position + 1 in mime_types, 0 for empty slots.
+// MIME_HASH_SEED was chosen so no two extensions share a slot. When changing the table above, generate both again with:
+//     gcc -DMIME_GENERATE_INDEX mime.c arena.c -o mime_index && ./mime_index
+static const unsigned char mime_index[MIME_TABLE_SIZE] = {
+      0,   0,  19,   0,   0,   0,  31,   0,   0,   0,   0,   0,   0,   0,  17,   0,
+     83,   0,   0,   0,  21,   0,   0,   0,   0,   0,   0,  72,   0,   0,   0,   0,
+     67,   0,  38,  58,   0,  30,   0,   0,   0,   0,  69,   0,   2,   0,   0,   0,
+      0,   0,   0,  44,   0,   6,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,  57,   0,  85,   0,   0,  65,   0,   5,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,  62,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,  14,  12,  56,   0,
+      0,   0,   0,   0,   0,   0,  33,   0,  59,   0,   0,  60,   0,   0,   0,   0,
+      0,   0,   9,   0,   0,  74,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,  20,   0,   0,   0,  48,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,  51,  81,   0,   0,  86,   0,   0,   0,   0,   0,  27,
+     24,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,  22,  78,
+     34,  50,   0,   0,   0,   0,  68,   0,   0,   0,   0,   0,   0,   0,  61,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   4,   0,  73,   0,
+     46,   0,   0,   0,  40,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,   0,  66,   0,   0,  77,   0,  39,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,   0,   0,  37,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,  53,   0,  43,   0,  49,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,  75,   0,   0,   0,   0,   0,   0,   0,   0,
+     71,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   1,   3,
+      0,   0,   0,   0,   0,   0,   0,   0,   0,  35,  76,  82,   0,   0,   0,   0,
+      0,  79,  28,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,  23,   0,   0,  32,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   8,   0,   0,   0,   0,  36,   0,   0,   0,   0,   0,   0,  55,
+      0,   0,   0,   0,   0,   0,   0,  16,  18,   0,  63,   0,   0,   0,   0,   0,
+      7,   0,   0,   0,   0,   0,   0,   0,  64,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,  84,   0,   0,  13,  41,  26,   0,   0,   0,   0,
+     11,   0,   0,  47,   0,   0,   0,   0,   0,   0,  42,   0,  52,   0,   0,   0,
+     45,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,  29,   0,   0,   0,
+     70,   0,   0,   0,   0,   0,   0,   0,   0,   0,  15,   0,   0,   0,   0,  80,
+      0,   0,   0,   0,   0,   0,  25,   0,   0,  54,   0,   0,   0,   0,   0,  10,
+};
+
+static MimeEntry *mime_loaded_types = NULL;
+static MimeEntry *mime_sniffed_types = NULL;
+static pthread_mutex_t mime_sniffed_lock = PTHREAD_MUTEX_INITIALIZER;
+static int mime_sniffing = 0;
+
+static unsigned int mime_hash(const char *ext, size_t length, unsigned int seed) {
+    unsigned int h = 2166136261u ^ seed; // FNV-1a over the lowercase extension
+    for (size_t i = 0; i < length; i++) {
+        h = (h ^ (unsigned char) tolower((unsigned char) ext[i])) * 16777619u;
+    }
+    return (h ^ (h >> 16)) & (MIME_TABLE_SIZE - 1);
+}
+
+void mime_entry_free(void *obj) {
+    MimeEntry *entry = (MimeEntry*) obj;
+    vector_free(entry->key);
+    vector_free(entry->value);
+}
+
+const char *mime_type_from_extension(const char *ext, size_t length) {
+    unsigned char i = mime_index[mime_hash(ext, length, MIME_HASH_SEED)];
+    if (i > 0 && 0 == strncasecmp(mime_types[i - 1].ext, ext, length) && mime_types[i - 1].ext[length] == '\0') {
+        return mime_types[i - 1].type;
+    }
+    if (mime_loaded_types != NULL && length < 32) {
+        char key[32];
+        for (size_t j = 0; j < length; j++) {
+            key[j] = tolower((unsigned char) ext[j]);
+        }
+        key[length] = '\0';
+        if (string_hashmap_contains(mime_loaded_types, key)) {
+            return string_hashmap_get(mime_loaded_types, key);
+        }
+    }
+    return NULL;
+}
+
+int mime_load_types(const char *path) {
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        return -1;
+    }
+    if (mime_loaded_types == NULL) {
+        mime_loaded_types = hashmap(mime_entry_free);
+    }
+    char *line = NULL;
+    size_t size = 0;
+    while (getline(&line, &size, fp) >= 0) {
+        char *saveptr = NULL;
+        char *type = strtok_r(line, " \t\r\n", &saveptr);
+        if (type == NULL || type[0] == '#') {
+            continue;
+        }
+        char *ext;
+        while ((ext = strtok_r(NULL, " \t\r\n", &saveptr)) != NULL) {
+            for (char *c = ext; *c; c++) {
+                *c = tolower((unsigned char) *c);
+            }
+            char *key = NULL;
+            string_push_cstr(key, ext);
+            char *value = NULL;
+            string_push_cstr(value, type);
+            string_hashmap_push(mime_loaded_types, key, value);
+        }
+    }
+    free(line);
+    fclose(fp);
+    return 0;
+}
+
+void mime_enable_sniffing(void) {
+    mime_sniffing = 1;
+}
+
+static char *mime_sniff(const char *path) {
+    char absolute_path[PATH_MAX];
+    if (realpath(path, absolute_path) == NULL) {
+        return NULL;
+    }
+    char *out = NULL;
+    if (process_sync((char *[]) {"file", "-b", "-i", absolute_path, NULL}, NULL, &out, NULL) != 0) {
+        free(out);
+        return NULL;
+    }
+    char *mime = NULL;
+    size_t length = strcspn(out, "\n");
+    if (length > 0) {
+        out[length] = '\0';
+        string_push_cstr(mime, out);
+    }
+    free(out);
+    return mime;
+}
+
+static const char *mime_sniff_lookup(const char *path) {
+    const char *type = NULL;
+    pthread_mutex_lock(&mime_sniffed_lock);
+    if (mime_sniffed_types != NULL && string_hashmap_contains(mime_sniffed_types, path)) {
+        type = string_hashmap_get(mime_sniffed_types, path);
+    }
+    pthread_mutex_unlock(&mime_sniffed_lock);
+    if (type != NULL) {
+        return type;
+    }
+
+    char *sniffed = mime_sniff(path);
+    if (sniffed == NULL) {
+        return MIME_DEFAULT_TYPE;
+    }
+    // Entries are never removed, so the returned value stays valid while the server runs
+    arena_assert_heap();
+    pthread_mutex_lock(&mime_sniffed_lock);
+    if (mime_sniffed_types == NULL) {
+        mime_sniffed_types = hashmap(mime_entry_free);
+    }
+    if (string_hashmap_contains(mime_sniffed_types, path)) {
+        type = string_hashmap_get(mime_sniffed_types, path);
+        vector_free(sniffed);
+    }
+    else if (hashmap_header(mime_sniffed_types)->insert_count < MIME_SNIFF_CACHE_MAX) {
+        char *key = NULL;
+        string_push_cstr(key, path);
+        string_hashmap_push(mime_sniffed_types, key, sniffed);
+        type = sniffed;
+    }
+    pthread_mutex_unlock(&mime_sniffed_lock);
+    if (type == NULL) {
+        vector_free(sniffed); // Cache is full, the type can't outlive this call
+        return MIME_DEFAULT_TYPE;
+    }
+    return type;
+}
+
+static const char *mime_sniff_cached(const char *path) {
+    ARENA_HEAP_SCOPE;
+    return mime_sniff_lookup(path);
+}
+
+const char *mime_type(const char *path) {
+    const char *name = strrchr(path, '/');
+    name = name != NULL ? name + 1 : path;
+    const char *ext = strrchr(name, '.');
+    if (ext != NULL) {
+        const char *type = mime_type_from_extension(ext + 1, strlen(ext + 1));
+        if (type != NULL) {
+            return type;
+        }
+    }
+    return mime_sniffing ? mime_sniff_cached(path) : MIME_DEFAULT_TYPE;
+}
+
+#ifdef MIME_GENERATE_INDEX
+int main() {
+    size_t count = sizeof(mime_types) / sizeof(mime_types[0]);
+    for (unsigned int seed = 0; seed < 1000000; seed++) {
+        unsigned char index[MIME_TABLE_SIZE] = {0};
+        size_t i = 0;
+        for (; i < count; i++) {
+            unsigned int slot = mime_hash(mime_types[i].ext, strlen(mime_types[i].ext), seed);
+            if (index[slot] != 0) break;
+            index[slot] = i + 1;
+        }
+        if (i < count) continue;
+        printf("#define MIME_HASH_SEED %uu\n", seed);
+        for (i = 0; i < MIME_TABLE_SIZE; i++) {
+            printf("%s%3d,%s", i % 16 == 0 ? "    " : "", index[i], i % 16 == 15 ? "\n" : " ");
+        }
+        return 0;
+    }
+    fprintf(stderr, "No seed found, increase MIME_TABLE_SIZE\n");
+    return 1;
+}
+#endif //MIME_GENERATE_INDEX
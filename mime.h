@@ -0,0 +1,21 @@
+#ifndef MIME_H
+#define MIME_H
+
+#include <stddef.h>
+
+#define MIME_DEFAULT_TYPE "application/octet-stream"
+
+// Returns the MIME type registered for an extension (without the dot), or NULL if it is unknown
+const char *mime_type_from_extension(const char *ext, size_t length);
+
+// Adds the extensions listed in a mime.types file to the ones known by the server.
+// It must be called before the workers start. Returns -1 if the file can't be read.
+int mime_load_types(const char *path);
+
+// Files with an unknown extension will have their type detected with `file -i`, the result is cached per path
+void mime_enable_sniffing(void);
+
+// Returns the MIME type for a path, it is never NULL and must not be freed
+const char *mime_type(const char *path);
+
+#endif //MIME_H
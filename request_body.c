@@ -0,0 +1,83 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include "request_body.h"
+#include "bfutils_vector.h"
+
+void request_body_init(RequestBody *body) {
+    body->data = NULL;
+    body->fd = -1;
+    body->length = 0;
+}
+
+static int request_body_write(int fd, const char *data, size_t length) {
+    while (length > 0) {
+        ssize_t l = write(fd, data, length);
+        if (l < 0 && errno == EINTR) {
+            continue;
+        }
+        if (l < 0) {
+            perror("write");
+            return -1;
+        }
+        data += l;
+        length -= l;
+    }
+    return 0;
+}
+
+// Creates a file that is never visible in the directory, so it is gone as soon as it's closed
+static int request_body_temp_file(void) {
+    const char *dir = getenv("TMPDIR");
+    if (dir == NULL || *dir == '\0') {
+        dir = "/tmp";
+    }
+    int fd = open(dir, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+    if (fd >= 0 || (errno != EOPNOTSUPP && errno != EISDIR)) {
+        if (fd < 0) perror("open");
+        return fd;
+    }
+    // The file system does not support O_TMPFILE
+    char *path = string_format("%s/server-body-XXXXXX", dir);
+    fd = mkostemp(path, O_CLOEXEC);
+    if (fd < 0) {
+        perror("mkostemp");
+    }
+    else {
+        unlink(path);
+    }
+    vector_free(path);
+    return fd;
+}
+
+int request_body_append(RequestBody *body, const char *data, size_t length) {
+    if (body->fd < 0 && body->length + length > REQUEST_BODY_SPILL_THRESHOLD) {
+        body->fd = request_body_temp_file();
+        if (body->fd < 0 || request_body_write(body->fd, body->data, body->length) < 0) {
+            return -1;
+        }
+        vector_free(body->data);
+    }
+    if (body->fd >= 0) {
+        if (request_body_write(body->fd, data, length) < 0) {
+            return -1;
+        }
+    }
+    else {
+        string_push_bytes(body->data, data, length);
+    }
+    body->length += length;
+    return 0;
+}
+
+void request_body_reset(RequestBody *body) {
+    vector_free(body->data);
+    if (body->fd >= 0) {
+        close(body->fd);
+    }
+    request_body_init(body);
+}
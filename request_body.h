@@ -0,0 +1,23 @@
+#ifndef REQUEST_BODY_H
+#define REQUEST_BODY_H
+
+#include <stddef.h>
+
+#define REQUEST_BODY_SPILL_THRESHOLD (64 * 1024)
+
+// A request body kept in memory, or in an unlinked temporary file once it grows past the spill threshold
+typedef struct {
+    char *data;
+    int fd;
+    size_t length;
+} RequestBody;
+
+void request_body_init(RequestBody *body);
+
+// Appends length bytes to the body. Returns -1 if the temporary file can't be created or written.
+int request_body_append(RequestBody *body, const char *data, size_t length);
+
+// Releases the memory or the temporary file, leaving an empty body
+void request_body_reset(RequestBody *body);
+
+#endif //REQUEST_BODY_H
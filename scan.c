@@ -0,0 +1,7 @@
+#include <string.h>
+#include "scan.h"
+
+// glibc's memchr, `bench scan` showed it beating hand-written SSE2 and AVX2 kernels on every request set
+const char *scan_find(const char *p, const char *end, char c) {
+    return memchr(p, c, end - p);
+}
@@ -0,0 +1,9 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <stddef.h>
+
+// Returns the first occurrence of c in [p, end), or NULL
+const char *scan_find(const char *p, const char *end, char c);
+
+#endif //SCAN_H
@@ -1,239 +1,1474 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <getopt.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <sys/stat.h>
 #include <netinet/in.h>
 #include <limits.h>
 #include <signal.h>
 #include <ucontext.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/sendfile.h>
 #include <poll.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <sys/random.h>
+#include "arena.h"
+// Vectors and hashmaps go through the arena hooks, so a response can be built in its connection's arena
+#define BFUTILS_REALLOC arena_hook_realloc
+#define BFUTILS_FREE arena_hook_free
+#define BFUTILS_HASHMAP_REALLOC arena_hook_realloc
+#define BFUTILS_HASHMAP_CALLOC arena_hook_calloc
+#define BFUTILS_HASHMAP_MALLOC arena_hook_malloc
+#define BFUTILS_HASHMAP_FREE arena_hook_free
 #define BFUTILS_VECTOR_IMPLEMENTATION
 #include "bfutils_vector.h"
 #define BFUTILS_HASHMAP_IMPLEMENTATION
 #include "bfutils_hash.h"
 #define BFUTILS_PROCESS_IMPLEMENTATION
 #include "bfutils_process.h"
+#include "mime.h"
+#include "file_cache.h"
+#include "compress.h"
+#include "http_parser.h"
+#include "request_body.h"
+#include "input_buffer.h"
+#include "uring.h"
 
 #define defer_return(r) { ret = (r); goto defer; }
 
+#define MAX_EVENTS 256
+#define RECV_CHUNK_SIZE 4096
+// Reading stops once this much is buffered, so a fast upload is moved to its body storage as it arrives
+#define RECV_BUFFER_LIMIT (64 * 1024)
+#define MAX_BODY_SIZE (1024L * 1024 * 1024)
+#define DEFAULT_IDLE_TIMEOUT 30
+#define DEFAULT_MAX_REQUESTS 1000
+#define MAX_WORKERS 256
+// Status line, head, connection headers, cached entry headers, blank line and body
+#define RESPONSE_IOV_COUNT 6
+#define URING_ENTRIES 1024
+// Receive buffers shared by the connections of a worker, each RECV_CHUNK_SIZE bytes
+#define URING_BUFFER_COUNT 1024
+// Files that are not cached are read into a buffer of this size and sent from it with io_uring
+#define FILE_CHUNK_SIZE (64 * 1024)
+// Streamed chunks start with a fixed width size line, so the data can be written right after it
+#define STREAM_CHUNK_HEADER_SIZE (sizeof("00000000\r\n") - 1)
+// Room left after the data for the CRLF closing the chunk and the last chunk
+#define STREAM_CHUNK_TRAILER_SIZE (sizeof("\r\n0\r\n\r\n") - 1)
+// Multiple ranges are assembled in memory, requests for more bytes than this get the whole file instead
+#define MULTIPART_MAX_SIZE (1024 * 1024)
+
+#define stats_add(counter, n) atomic_fetch_add_explicit(&(counter), (n), memory_order_relaxed)
+#define stats_sub(counter, n) atomic_fetch_sub_explicit(&(counter), (n), memory_order_relaxed)
+#define stats_load(counter) atomic_load_explicit(&(counter), memory_order_relaxed)
+
+// Response headers are keyed by their interned name, only the value is allocated
 typedef struct {
-    char *key;
+    HttpHeaderId key;
     char *value;
 } HttpHeader;
 
-typedef struct {
-    char *protocol;
-    char *path;
-    HttpHeader *headers;
-    char *body;
-} HttpReq;
-
 typedef struct {
     int status_code;
     HttpHeader *headers;
     char *body;
+    // When file_fd is valid the body is streamed from the file instead of the body vector
+    int file_fd;
+    size_t file_size;
+    // Cached files carry their own Content-Type and Content-Length headers and body
+    FileCacheEntry *entry;
+    // Set for a single range response, only that part of the file or entry is sent
+    int ranged;
+    HttpRange range;
+    // Set when file_fd is compressed while it is sent, with the chunked transfer coding. HEAD responses are
+    // chunked too, to get the same headers, but have no stream
+    int chunked;
+    CompressStream *stream;
 } HttpRes;
 
 void http_header_free(void *obj) {
     HttpHeader *header = (HttpHeader*) obj;
-    vector_free(header->key);
     vector_free(header->value);
 }
 
-HttpReq parse_http_request(const char *request) {
-    HttpReq req = {0};
-    req.headers = hashmap(http_header_free);
-    char **lines = string_split(request, "\r\n");
-    if(vector_length(lines) > 0) {
-        char **status_line = string_split(lines[0], " ");
-        if (vector_length(status_line) > 2) {
-            req.protocol = status_line[0];
-            req.path = status_line[1];
-            for (int i = 2; i < vector_length(status_line); i++) {
-                vector_free(status_line[i]);
+void print_http_request(HttpReq *req) {
+    printf("Method: %.*s\nPath: %.*s\nHeaders:\n", (int) req->method.length, req->method.data, (int) req->path.length, req->path.data);
+    for (size_t i = 0; i < req->header_count; i++) {
+        HttpHeaderView header = req->headers[i];
+        printf("\t%.*s:%.*s\n", (int) header.name.length, header.name.data, (int) header.value.length, header.value.data);
+    }
+    if (req->body_fd >= 0) {
+        printf("Body:\n(%zu bytes in a temporary file)\n", req->body.length);
+    }
+    else {
+        printf("Body:\n%.*s\n", (int) req->body.length, req->body.data);
+    }
+}
+
+// Headers that are not in a prebuilt block: the headers in the map, then Content-Length unless the cached file
+// carries it in entry->headers, the body is streamed or the status has no body. Ranged responses leave it out
+// of entry->headers. Status codes missing from the status table get their status line here too.
+char *http_response_head(HttpRes *res) {
+    char *head = NULL;
+    vector_ensure_capacity(head, 256);
+    if (http_status_line(res->status_code).data == NULL) {
+        string_push_cstr(head, "HTTP/1.1 ");
+        size_t digits = http_format_size(string_reserve(head, HTTP_SIZE_DIGITS), res->status_code);
+        string_commit(head, digits);
+        string_push_cstr(head, " \r\n");
+    }
+
+    HashmapIterator it = hashmap_iterator(res->headers);
+    while(hashmap_iterator_has_next(&it)) {
+        HttpHeader header = hashmap_iterator_next(res->headers, &it);
+        string_push_bytes(head, http_header_names[header.key].data, http_header_names[header.key].length);
+        string_push_cstr(head, ": ");
+        string_push(head, header.value);
+        string_push_cstr(head, "\r\n");
+    }
+    if ((res->entry == NULL || res->ranged) && !res->chunked && res->status_code != 304 && res->status_code != 204) {
+        string_push_cstr(head, "Content-Length: ");
+        size_t length = res->ranged ? res->range.length : res->file_fd >= 0 ? res->file_size : vector_length(res->body);
+        size_t digits = http_format_size(string_reserve(head, HTTP_SIZE_DIGITS), length);
+        string_commit(head, digits);
+        string_push_cstr(head, "\r\n");
+    }
+    return head;
+}
+
+char *not_found_body(StringView path) {
+    char *body = string_format("<html><head><title>Page not found</title></head><body><h1>Page not found</h1><p>Page %.*s not found</p></body></html>", (int) path.length, path.data);
+    return body;
+}
+
+HttpRes http_response_new(int status_code) {
+    HttpRes res = {.status_code = status_code, .file_fd = -1};
+    res.headers = hashmap(http_header_free);
+    return res;
+}
+
+void http_response_free(HttpRes *res) {
+    if (res->file_fd >= 0) {
+        close(res->file_fd);
+        res->file_fd = -1;
+    }
+    if (res->entry != NULL) {
+        file_cache_release(res->entry);
+        res->entry = NULL;
+    }
+    compress_stream_free(res->stream);
+    res->stream = NULL;
+    vector_free(res->body);
+    hashmap_free(res->headers);
+}
+
+// Maps the request target to a file under folder. Dot segments are resolved without leaving folder
+// and the query string is ignored. Returns NULL if the target is not an absolute path.
+char *resolve_request_path(const char *folder, StringView target) {
+    if (target.length == 0 || target.data[0] != '/') {
+        return NULL;
+    }
+    char *path = NULL;
+    string_push_cstr(path, folder);
+    size_t root_length = vector_length(path);
+    const char *end = target.data;
+    while (end < target.data + target.length && *end != '?' && *end != '#') end++;
+    const char *p = target.data;
+    while (p < end) {
+        while (p < end && *p == '/') p++;
+        const char *segment = p;
+        while (p < end && *p != '/') p++;
+        size_t length = p - segment;
+        if (length == 0 || (length == 1 && segment[0] == '.')) {
+            continue;
+        }
+        if (length == 2 && segment[0] == '.' && segment[1] == '.') {
+            char *parent = memrchr(path + root_length, '/', vector_length(path) - root_length);
+            vector_header(path)->length = parent != NULL ? (size_t) (parent - path) : root_length;
+            path[vector_length(path)] = '\0';
+            continue;
+        }
+        string_push_bytes(path, "/", 1);
+        string_push_bytes(path, segment, length);
+    }
+    if (end[-1] == '/') {
+        string_push_cstr(path, "/index.html");
+    }
+    return path;
+}
+
+// Cache-Control value sent for the paths starting with prefix
+typedef struct {
+    char *prefix;
+    char *value;
+} CacheControlRule;
+
+typedef struct {
+    char *files;
+    long idle_timeout_ms;
+    long max_requests;
+    // Connection and Keep-Alive lines of every persistent response, built once the timeout is known
+    char *keep_alive_headers;
+    // Workers use io_uring instead of epoll when it is available
+    int io_uring;
+    // The longest matching prefix wins
+    CacheControlRule *cache_control;
+} ServerConfig;
+
+// Returns the Cache-Control value configured for the request target, or NULL
+const char *cache_control_for(const ServerConfig *config, StringView target) {
+    const char *value = NULL;
+    size_t longest = 0;
+    for (size_t i = 0; i < vector_length(config->cache_control); i++) {
+        CacheControlRule rule = config->cache_control[i];
+        size_t length = strlen(rule.prefix);
+        if (length <= target.length && length >= longest && memcmp(rule.prefix, target.data, length) == 0) {
+            value = rule.value;
+            longest = length;
+        }
+    }
+    return value;
+}
+
+// If-None-Match takes precedence over If-Modified-Since, and both only apply to GET and HEAD
+int http_request_not_modified(const HttpReq *req, const FileValidators *validators) {
+    if (!sv_equals(req->method, sv_cstr("GET")) && !sv_equals(req->method, sv_cstr("HEAD"))) {
+        return 0;
+    }
+    StringView if_none_match = http_request_known_header(req, HTTP_HEADER_IF_NONE_MATCH);
+    if (if_none_match.data != NULL) {
+        return http_etag_matches(if_none_match, (StringView) {.data = validators->etag, .length = strlen(validators->etag)});
+    }
+    StringView if_modified_since = http_request_known_header(req, HTTP_HEADER_IF_MODIFIED_SINCE);
+    time_t since;
+    return if_modified_since.data != NULL && http_parse_date(if_modified_since, &since) == 0 && validators->mtime <= since;
+}
+
+// Ranges only apply to GET. With If-Range they apply while the client has the current representation,
+// the ETag must be equal with the strong comparison and the date must be the exact modification time.
+int http_request_range_applies(const HttpReq *req, const FileValidators *validators) {
+    if (!sv_equals(req->method, sv_cstr("GET"))) {
+        return 0;
+    }
+    StringView if_range = http_request_known_header(req, HTTP_HEADER_IF_RANGE);
+    if (if_range.data == NULL) {
+        return 1;
+    }
+    if (if_range.length > 0 && if_range.data[0] == '"') {
+        return sv_equals(if_range, (StringView) {.data = validators->etag, .length = strlen(validators->etag)});
+    }
+    time_t date;
+    return http_parse_date(if_range, &date) == 0 && date == validators->mtime;
+}
+
+// Random start of every multipart boundary, so a served file can't be made to contain the boundary of its own response
+uint64_t multipart_boundary_prefix;
+
+__attribute__((constructor))
+void multipart_boundary_init(void) {
+    if (getrandom(&multipart_boundary_prefix, sizeof(multipart_boundary_prefix), GRND_NONBLOCK) != sizeof(multipart_boundary_prefix)) {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        multipart_boundary_prefix = ((uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec) ^ ((uint64_t) getpid() << 32);
+    }
+}
+
+// Replaces res, which sends a file or cached entry, with a multipart/byteranges response holding the ranges.
+// Returns -1 and leaves res alone when the parts are too big or the file can't be read.
+int http_response_multipart(HttpRes *res, const HttpRange *ranges, int count, const char *mime, HttpContentEncoding encoding,
+                            const FileValidators *validators, int vary) {
+    static atomic_ulong boundaries;
+    size_t total = 0;
+    for (int i = 0; i < count; i++) {
+        total += ranges[i].length;
+    }
+    if (total > MULTIPART_MAX_SIZE) {
+        return -1;
+    }
+    size_t size = res->entry != NULL ? res->entry->size : res->file_size;
+    char boundary[40];
+    snprintf(boundary, sizeof(boundary), "%016" PRIx64 "%020lu", multipart_boundary_prefix,
+             atomic_fetch_add_explicit(&boundaries, 1, memory_order_relaxed));
+    char *body = NULL;
+    vector_ensure_capacity(body, total + count * 128);
+    for (int i = 0; i < count; i++) {
+        HttpRange range = ranges[i];
+        char *part = string_format("\r\n--%s\r\nContent-Type: %s\r\nContent-Range: bytes %zu-%zu/%zu\r\n\r\n",
+                                   boundary, mime, range.offset, range.offset + range.length - 1, size);
+        string_push(body, part);
+        vector_free(part);
+        char *data = string_reserve(body, range.length);
+        if (res->entry != NULL) {
+            memcpy(data, res->entry->data + range.offset, range.length);
+        }
+        else {
+            for (size_t read = 0; read < range.length;) {
+                ssize_t l = pread(res->file_fd, data + read, range.length - read, range.offset + read);
+                if (l <= 0) {
+                    if (l < 0 && errno == EINTR) {
+                        continue;
+                    }
+                    perror("pread");
+                    vector_free(body);
+                    return -1;
+                }
+                read += l;
+            }
+        }
+        string_commit(body, range.length);
+    }
+    char *closing = string_format("\r\n--%s--\r\n", boundary);
+    string_push(body, closing);
+    vector_free(closing);
+
+    http_response_free(res);
+    *res = http_response_new(206);
+    hashmap_push(res->headers, HTTP_HEADER_CONTENT_TYPE, string_format("multipart/byteranges; boundary=%s", boundary));
+    if (encoding != HTTP_ENCODING_IDENTITY) {
+        hashmap_push(res->headers, HTTP_HEADER_CONTENT_ENCODING, string_format("%s", http_encoding_names[encoding]));
+    }
+    if (vary) {
+        hashmap_push(res->headers, HTTP_HEADER_VARY, string_format("Accept-Encoding"));
+    }
+    char date[HTTP_DATE_LENGTH + 1];
+    http_format_date(date, validators->mtime);
+    hashmap_push(res->headers, HTTP_HEADER_ETAG, string_format("%s", validators->etag));
+    hashmap_push(res->headers, HTTP_HEADER_LAST_MODIFIED, string_format("%s", date));
+    res->body = body;
+    return 0;
+}
+
+// Only static files are served, so GET and HEAD are the only methods allowed
+HttpRes handle_request(HttpReq *req, const ServerConfig *config) {
+    if (!sv_equals(req->method, sv_cstr("GET")) && !sv_equals(req->method, sv_cstr("HEAD"))) {
+        HttpRes res = http_response_new(405);
+        hashmap_push(res.headers, HTTP_HEADER_ALLOW, string_format("GET, HEAD"));
+        return res;
+    }
+    char *path = resolve_request_path(config->files, req->path);
+    if (path == NULL) {
+        return http_response_new(400);
+    }
+    HttpRes res = http_response_new(200);
+    FileValidators validators;
+    res.entry = file_cache_open(path, &res.file_fd, &res.file_size, &validators);
+    if (res.entry == NULL && res.file_fd < 0) {
+        res.status_code = 404;
+        res.body = not_found_body(req->path);
+        vector_free(path);
+        return res;
+    }
+    StringView accept_encoding = http_request_known_header(req, HTTP_HEADER_ACCEPT_ENCODING);
+    unsigned encodings = accept_encoding.data != NULL ? http_accept_encodings(accept_encoding) : 0;
+    int vary;
+    const char *mime;
+    HttpContentEncoding encoding = HTTP_ENCODING_IDENTITY;
+    if (res.entry != NULL) {
+        FileCacheEntry *variant = encodings != 0 ? file_cache_variant(res.entry, encodings) : NULL;
+        if (variant != NULL) {
+            file_cache_release(res.entry);
+            res.entry = variant;
+        }
+        validators = res.entry->validators;
+        mime = res.entry->mime;
+        encoding = res.entry->encoding;
+        vary = encoding != HTTP_ENCODING_IDENTITY || compress_eligible(mime);
+    }
+    else {
+        // Files too big for the cache are not compressed on the fly, only their precompressed siblings are used
+        mime = mime_type(path);
+        size_t size;
+        int fd = encodings != 0 ? file_cache_open_sibling(path, encodings, &encoding, &size) : -1;
+        hashmap_push(res.headers, HTTP_HEADER_CONTENT_TYPE, string_format("%s", mime));
+        if (fd >= 0) {
+            close(res.file_fd);
+            res.file_fd = fd;
+            res.file_size = size;
+        }
+        else if ((encodings & (1u << HTTP_ENCODING_GZIP)) && compress_eligible(mime) && sv_equals(req->version, sv_cstr("HTTP/1.1"))
+                 && http_request_known_header(req, HTTP_HEADER_RANGE).data == NULL) {
+            // Without a sibling the file is gzipped while it is sent, its length is only known at the end.
+            // Range requests get the file as it is, since the offsets of the compressed bytes are not known.
+            if (!sv_equals(req->method, sv_cstr("HEAD"))) {
+                res.stream = compress_stream_new(HTTP_ENCODING_GZIP);
+            }
+            res.chunked = res.stream != NULL || sv_equals(req->method, sv_cstr("HEAD"));
+            if (res.chunked) {
+                encoding = HTTP_ENCODING_GZIP;
+                hashmap_push(res.headers, HTTP_HEADER_TRANSFER_ENCODING, string_format("chunked"));
+            }
+        }
+        if (encoding != HTTP_ENCODING_IDENTITY) {
+            hashmap_push(res.headers, HTTP_HEADER_CONTENT_ENCODING, string_format("%s", http_encoding_names[encoding]));
+            file_validators_encode(&validators, encoding);
+        }
+        vary = fd >= 0 || compress_eligible(mime);
+        if (vary) {
+            hashmap_push(res.headers, HTTP_HEADER_VARY, string_format("Accept-Encoding"));
+        }
+    }
+    char date[HTTP_DATE_LENGTH + 1];
+    http_format_date(date, validators.mtime);
+    if (http_request_not_modified(req, &validators)) {
+        http_response_free(&res);
+        res = http_response_new(304);
+        hashmap_push(res.headers, HTTP_HEADER_ETAG, string_format("%s", validators.etag));
+        hashmap_push(res.headers, HTTP_HEADER_LAST_MODIFIED, string_format("%s", date));
+        if (vary) {
+            hashmap_push(res.headers, HTTP_HEADER_VARY, string_format("Accept-Encoding"));
+        }
+    }
+    else {
+        if (res.entry == NULL) {
+            // Cached files carry these in their prebuilt headers
+            if (!res.chunked) {
+                hashmap_push(res.headers, HTTP_HEADER_ACCEPT_RANGES, string_format("bytes"));
+            }
+            hashmap_push(res.headers, HTTP_HEADER_ETAG, string_format("%s", validators.etag));
+            hashmap_push(res.headers, HTTP_HEADER_LAST_MODIFIED, string_format("%s", date));
+        }
+        StringView range = http_request_known_header(req, HTTP_HEADER_RANGE);
+        if (range.data != NULL && http_request_range_applies(req, &validators)) {
+            size_t size = res.entry != NULL ? res.entry->size : res.file_size;
+            HttpRange ranges[HTTP_MAX_RANGES];
+            int count = http_parse_ranges(range, size, ranges);
+            if (count == 0) {
+                http_response_free(&res);
+                res = http_response_new(416);
+                hashmap_push(res.headers, HTTP_HEADER_CONTENT_RANGE, string_format("bytes */%zu", size));
+            }
+            else if (count == 1) {
+                res.status_code = 206;
+                res.ranged = 1;
+                res.range = ranges[0];
+                hashmap_push(res.headers, HTTP_HEADER_CONTENT_RANGE, string_format("bytes %zu-%zu/%zu",
+                             res.range.offset, res.range.offset + res.range.length - 1, size));
             }
-            vector_free(status_line);
-            vector_free(lines[0]);
-
-            int is_body = 0;
-            char *body = NULL;
-            for (int i = 1; i < vector_length(lines); i++) {
-                if (0 == strcmp(lines[i], "")) {
-                    is_body = 1;
-                    vector_free(lines[i]);
+            else if (count > 1) {
+                // When it fails the whole file is sent, as if there was no Range
+                http_response_multipart(&res, ranges, count, mime, encoding, &validators, vary);
+            }
+        }
+    }
+    const char *cache_control = cache_control_for(config, req->path);
+    if (cache_control != NULL) {
+        hashmap_push(res.headers, HTTP_HEADER_CACHE_CONTROL, string_format("%s", cache_control));
+    }
+    vector_free(path);
+    return res;
+}
+
+
+typedef enum {
+    CONNECTION_READING_HEADERS,
+    CONNECTION_READING_BODY,
+    CONNECTION_WRITING_RESPONSE,
+    CONNECTION_DRAINING,
+} ConnectionState;
+
+typedef struct Connection {
+    int fd;
+    ConnectionState state;
+    int keep_alive;
+    int peer_closed;
+    long requests;
+    InputBuffer in;
+    HttpParser parser;
+    HttpChunkedDecoder chunked;
+    // Bytes of a Content-Length body not received yet
+    size_t body_remaining;
+    RequestBody body;
+    // Status of the error response when the request can't be served, 0 otherwise
+    int error_status;
+    // Holds the response being sent, it is reset when the next request starts
+    Arena arena;
+    // The response head and in-memory body are sent from iov, pointing into out, out_body, the cached entry
+    // and static blocks. iov_next is the first element not fully sent.
+    char *out;
+    char *out_body;
+    struct iovec iov[RESPONSE_IOV_COUNT];
+    int iov_count;
+    int iov_next;
+    int file_fd;
+    off_t file_offset;
+    size_t file_remaining;
+    FileCacheEntry *entry;
+    // io_uring only: operations in flight, the connection is freed once they completed after it was closed
+    int uring_pending;
+    int recv_armed;
+    // A cancel was submitted for the receive because the input buffer is full
+    int recv_paused;
+    int sending;
+    int closing;
+    struct msghdr msg;
+    // Part of the file being sent from file_chunk
+    char *file_chunk;
+    size_t chunk_length;
+    size_t chunk_sent;
+    // Streamed responses read the file into stream_input and compress it to file_chunk one chunk at a time,
+    // so they use the same memory whatever the file size
+    CompressStream *stream;
+    char *stream_input;
+    const char *stream_next;
+    size_t stream_available;
+    int stream_done;
+    long last_activity;
+    struct Connection *prev;
+    struct Connection *next;
+} Connection;
+
+typedef struct {
+    atomic_ulong accepted;
+    atomic_ulong active;
+    atomic_ulong requests;
+    atomic_ulong bytes_sent;
+} WorkerStats;
+
+typedef struct {
+    int epoll_fd;
+    int listen_fd;
+    int shutdown_fd;
+    ServerConfig *config;
+    // Set while the worker runs the io_uring loop
+    Uring *ring;
+    // Connections closed while the ring still uses them
+    long closing;
+    WorkerStats stats;
+    // Connections ordered by last activity, the head is the one idle for the longest time
+    Connection *head;
+    Connection *tail;
+} EventLoop;
+
+typedef struct {
+    int id;
+    pthread_t thread;
+    EventLoop loop;
+} Worker;
+
+long now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+void connection_unlink(EventLoop *loop, Connection *conn) {
+    if (conn->prev) conn->prev->next = conn->next;
+    else loop->head = conn->next;
+    if (conn->next) conn->next->prev = conn->prev;
+    else loop->tail = conn->prev;
+    conn->prev = NULL;
+    conn->next = NULL;
+}
+
+void connection_touch(EventLoop *loop, Connection *conn) {
+    conn->last_activity = now_ms();
+    if (loop->tail == conn) return;
+    connection_unlink(loop, conn);
+    conn->prev = loop->tail;
+    if (loop->tail) loop->tail->next = conn;
+    else loop->head = conn;
+    loop->tail = conn;
+}
+
+Connection *connection_open(EventLoop *loop, int fd) {
+    Connection *conn = calloc(1, sizeof(Connection));
+    conn->fd = fd;
+    conn->file_fd = -1;
+    conn->state = CONNECTION_READING_HEADERS;
+    input_buffer_init(&conn->in);
+    http_parser_reset(&conn->parser);
+    request_body_init(&conn->body);
+    struct epoll_event ev = {.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET, .data.ptr = conn};
+    if (loop->ring == NULL && epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        perror("epoll_ctl");
+        free(conn);
+        return NULL;
+    }
+    connection_touch(loop, conn);
+    stats_add(loop->stats.accepted, 1);
+    stats_add(loop->stats.active, 1);
+    return conn;
+}
+
+void connection_free(EventLoop *loop, Connection *conn) {
+    close(conn->fd); // Closing the fd also removes it from the epoll set
+    input_buffer_free(&conn->in);
+    vector_free(conn->out);
+    vector_free(conn->out_body);
+    arena_destroy(&conn->arena);
+    request_body_reset(&conn->body);
+    if (conn->file_fd >= 0) {
+        close(conn->file_fd);
+    }
+    if (conn->entry != NULL) {
+        file_cache_release(conn->entry);
+    }
+    free(conn->file_chunk);
+    compress_stream_free(conn->stream);
+    free(conn->stream_input);
+    free(conn);
+    stats_sub(loop->stats.active, 1);
+}
+
+void connection_close(EventLoop *loop, Connection *conn) {
+    connection_unlink(loop, conn);
+    if (conn->uring_pending > 0) {
+        // The shutdown ends the receive and the sends still in flight, the last completion frees the connection
+        shutdown(conn->fd, SHUT_RDWR);
+        conn->closing = 1;
+        loop->closing++;
+        return;
+    }
+    connection_free(loop, conn);
+}
+
+// Returns -1 on error, 1 if the peer closed its side of the connection, 0 when there is no more data to read
+// and 2 when the buffer is full before the socket was drained
+int connection_read(Connection *conn) {
+    while (1) {
+        if (input_buffer_length(&conn->in) >= RECV_BUFFER_LIMIT) {
+            return 2;
+        }
+        size_t available;
+        char *space = input_buffer_reserve(&conn->in, RECV_CHUNK_SIZE, &available);
+        ssize_t l = recv(conn->fd, space, available, 0);
+        if (l > 0) {
+            input_buffer_commit(&conn->in, l);
+            continue;
+        }
+        if (l == 0) {
+            return 1;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return 0;
+        }
+        return -1;
+    }
+}
+
+// Drops the first sent bytes from the iovec list
+void connection_advance_iov(Connection *conn, size_t sent) {
+    while (sent > 0 && conn->iov_next < conn->iov_count) {
+        struct iovec *iov = &conn->iov[conn->iov_next];
+        if (sent < iov->iov_len) {
+            iov->iov_base = (char*) iov->iov_base + sent;
+            iov->iov_len -= sent;
+            return;
+        }
+        sent -= iov->iov_len;
+        conn->iov_next++;
+    }
+}
+
+// Returns a non-zero value while a streamed response has chunks left to produce or send
+int connection_streaming(Connection *conn) {
+    return conn->stream != NULL && (conn->chunk_sent < conn->chunk_length || !conn->stream_done);
+}
+
+// Compresses the next part of the file into file_chunk, framed as a chunk. The last one is followed by the
+// zero-length chunk. Returns -1 if the file can't be read.
+int connection_fill_stream(Connection *conn) {
+    if (conn->file_chunk == NULL) {
+        conn->file_chunk = malloc(FILE_CHUNK_SIZE);
+    }
+    if (conn->stream_input == NULL) {
+        conn->stream_input = malloc(FILE_CHUNK_SIZE);
+    }
+    if (conn->file_chunk == NULL || conn->stream_input == NULL) {
+        return -1;
+    }
+    char *data = conn->file_chunk + STREAM_CHUNK_HEADER_SIZE;
+    size_t capacity = FILE_CHUNK_SIZE - STREAM_CHUNK_HEADER_SIZE - STREAM_CHUNK_TRAILER_SIZE;
+    size_t length = 0;
+    while (length < capacity && !conn->stream_done) {
+        if (conn->stream_available == 0 && conn->file_remaining > 0) {
+            size_t wanted = conn->file_remaining < FILE_CHUNK_SIZE ? conn->file_remaining : FILE_CHUNK_SIZE;
+            ssize_t l = pread(conn->file_fd, conn->stream_input, wanted, conn->file_offset);
+            if (l <= 0) {
+                if (l < 0 && errno == EINTR) {
                     continue;
                 }
-                if (!is_body) {
-                    char *saveptr = NULL;
-                    char *key = NULL;
-                    char *value = NULL;
-                    char *v = strtok_r(lines[i], ": ", &saveptr);
-                    string_push_cstr(key, v);
-                    v = strtok_r(NULL, "", &saveptr);
-                    string_push_cstr(value, v + 1);
-                    string_hashmap_push(req.headers, key, value);
-                }
-                else {
-                    string_push(body, lines[i]);
-                }
-                vector_free(lines[i]);
+                return -1; // A read error, or the file was truncated after the headers were sent
             }
-            req.body = body;
+            conn->file_offset += l;
+            conn->file_remaining -= l;
+            conn->stream_next = conn->stream_input;
+            conn->stream_available = l;
         }
+        length += compress_stream_write(conn->stream, &conn->stream_next, &conn->stream_available, data + length,
+                                        capacity - length, conn->file_remaining == 0, &conn->stream_done);
     }
-    vector_free(lines);
-    return req;
+    size_t end = STREAM_CHUNK_HEADER_SIZE + length;
+    if (length > 0) {
+        for (size_t i = 0, size = length; i < 8; i++, size >>= 4) {
+            conn->file_chunk[7 - i] = "0123456789abcdef"[size & 15];
+        }
+        memcpy(conn->file_chunk + 8, "\r\n", 2);
+        memcpy(conn->file_chunk + end, "\r\n", 2);
+        end += 2;
+    }
+    if (conn->stream_done) {
+        memcpy(conn->file_chunk + end, "0\r\n\r\n", 5);
+        end += 5;
+    }
+    conn->chunk_sent = length > 0 ? 0 : STREAM_CHUNK_HEADER_SIZE;
+    conn->chunk_length = end;
+    return 0;
 }
 
-void print_http_request(HttpReq *req) {
-    printf("Protocol: %s\nPath: %s\nHeaders:\n", req->protocol, req->path);
-    HashmapIterator it = hashmap_iterator(req->headers);
-    while(hashmap_iterator_has_next(&it)) {
-        HttpHeader header = hashmap_iterator_next(req->headers, &it);
-        printf("\t%s:%s\n", header.key, header.value);
+// Returns -1 on error, 1 when the whole response was sent and 0 when the socket is not writable anymore
+int connection_write(EventLoop *loop, Connection *conn) {
+    while (conn->iov_next < conn->iov_count) {
+        // MSG_MORE lets the head and the start of the file share packets
+        struct msghdr msg = {.msg_iov = conn->iov + conn->iov_next, .msg_iovlen = conn->iov_count - conn->iov_next};
+        ssize_t l = sendmsg(conn->fd, &msg, MSG_NOSIGNAL | (conn->file_remaining > 0 ? MSG_MORE : 0));
+        if (l >= 0) {
+            connection_advance_iov(conn, l);
+            stats_add(loop->stats.bytes_sent, l);
+            continue;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return 0;
+        }
+        return -1;
+    }
+    // Chunks are only produced once the previous one was sent, the socket buffer paces the compression
+    while (connection_streaming(conn)) {
+        if (conn->chunk_sent == conn->chunk_length && connection_fill_stream(conn) < 0) {
+            return -1;
+        }
+        ssize_t l = send(conn->fd, conn->file_chunk + conn->chunk_sent, conn->chunk_length - conn->chunk_sent, MSG_NOSIGNAL);
+        if (l >= 0) {
+            conn->chunk_sent += l;
+            stats_add(loop->stats.bytes_sent, l);
+            continue;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return 0;
+        }
+        return -1;
     }
-    printf("Body:\n%s\n", req->body); 
+    while (conn->stream == NULL && conn->file_remaining > 0) {
+        ssize_t l = sendfile(conn->fd, conn->file_fd, &conn->file_offset, conn->file_remaining);
+        if (l > 0) {
+            conn->file_remaining -= l;
+            stats_add(loop->stats.bytes_sent, l);
+            continue;
+        }
+        if (l == 0) {
+            return -1; // The file was truncated after the headers were sent
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return 0;
+        }
+        return -1;
+    }
+    return 1;
 }
 
-char *http_response_to_bytes(HttpRes *res) {
-    char *response = NULL;
-    char *status_line = string_format("HTTP/1.1 %d OK\r\n", res->status_code);
-    string_push(response, status_line);
-    vector_free(status_line);
+// Returns -1 on error, 1 when the peer closed the connection and 0 when there is no more data to discard
+int connection_drain(Connection *conn) {
+    char buf[RECV_CHUNK_SIZE];
+    while (1) {
+        ssize_t l = recv(conn->fd, buf, sizeof(buf), 0);
+        if (l > 0) continue;
+        if (l == 0) return 1;
+        if (errno == EINTR) continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+        return -1;
+    }
+}
 
-    char *content_length = string_format("%d", vector_length(res->body));
-    string_hashmap_push(res->headers, string_format("Content-Length"), content_length);
+// HTTP/1.1 connections are persistent unless the client asks otherwise, HTTP/1.0 ones only when asked
+int http_request_keep_alive(HttpReq *req) {
+    StringView connection = http_request_known_header(req, HTTP_HEADER_CONNECTION);
+    if (connection.data != NULL && sv_contains_case(connection, sv_cstr("close"))) {
+        return 0;
+    }
+    if (sv_equals(req->version, sv_cstr("HTTP/1.1"))) {
+        return 1;
+    }
+    return connection.data != NULL && sv_contains_case(connection, sv_cstr("keep-alive"));
+}
 
-    HashmapIterator it = hashmap_iterator(res->headers);
-    while(hashmap_iterator_has_next(&it)) {
-        HttpHeader header = hashmap_iterator_next(res->headers, &it);
-        string_push(response, header.key);
-        string_push_cstr(response, ": ");
-        string_push(response, header.value);
-        string_push_cstr(response, "\r\n");
+// Sets up the body framing given by the headers. Clients that sent Expect: 100-continue are told to go on right away.
+void connection_begin_body(Connection *conn) {
+    if (conn->parser.status != HTTP_PARSE_DONE) {
+        conn->error_status = conn->parser.status == HTTP_PARSE_TOO_LARGE ? 431 : 400;
+        return;
+    }
+    if (conn->parser.content_length > MAX_BODY_SIZE) {
+        conn->error_status = 413;
+        return;
+    }
+    conn->body_remaining = conn->parser.content_length;
+    http_chunked_reset(&conn->chunked);
+    if (!conn->parser.chunked && conn->parser.content_length == 0) {
+        return;
+    }
+    HttpReq *req = http_parser_request(&conn->parser, input_buffer_data(&conn->in));
+    StringView expect = http_request_known_header(req, HTTP_HEADER_EXPECT);
+    if (expect.data != NULL && sv_equals_case(expect, sv_cstr("100-continue")) && sv_equals(req->version, sv_cstr("HTTP/1.1"))
+        && input_buffer_length(&conn->in) == conn->parser.header_length) {
+        static const char continue_response[] = "HTTP/1.1 100 Continue\r\n\r\n";
+        // Nothing else is being sent on the connection, a failed send only makes the client wait for its timeout
+        (void) send(conn->fd, continue_response, sizeof(continue_response) - 1, MSG_NOSIGNAL);
     }
-    string_push_cstr(response, "\r\n");
-    string_push(response, res->body);
-    return response;
 }
 
-char *read_entire_file(const char *path){
-    struct stat file_stat;
-    if (stat(path, &file_stat) < 0) {
-        return NULL;
+// Moves the body bytes received so far from the receive buffer to the body storage.
+// Returns a non-zero value when the body is complete or it can't be read.
+int connection_read_body(Connection *conn) {
+    char *data = input_buffer_data(&conn->in) + conn->parser.header_length;
+    size_t available = input_buffer_length(&conn->in) - conn->parser.header_length;
+    size_t consumed;
+    size_t decoded;
+    if (conn->parser.chunked) {
+        decoded = http_chunked_decode(&conn->chunked, data, available, &consumed);
+    }
+    else {
+        consumed = decoded = available < conn->body_remaining ? available : conn->body_remaining;
+        conn->body_remaining -= consumed;
     }
-    size_t size = file_stat.st_size;
-    int is_file = file_stat.st_mode & (S_IFREG | S_IFLNK);
+    if (conn->body.length + decoded > MAX_BODY_SIZE) {
+        conn->error_status = 413;
+        return 1;
+    }
+    if (decoded > 0 && request_body_append(&conn->body, data, decoded) < 0) {
+        conn->error_status = 500;
+        return 1;
+    }
+    // The headers stay where they are, the request views point to them
+    input_buffer_erase(&conn->in, conn->parser.header_length, consumed);
+    if (!conn->parser.chunked) {
+        return conn->body_remaining == 0;
+    }
+    if (conn->chunked.status != HTTP_PARSE_INCOMPLETE && conn->chunked.status != HTTP_PARSE_DONE) {
+        conn->error_status = conn->chunked.status == HTTP_PARSE_TOO_LARGE ? 413 : 400;
+    }
+    return conn->chunked.status != HTTP_PARSE_INCOMPLETE;
+}
 
-    if (!is_file) {
-        return NULL;
+// Returns a non-zero value when a whole request, or a request that can't be served, was received
+int connection_request_ready(Connection *conn) {
+    if (conn->state == CONNECTION_READING_HEADERS) {
+        HttpParseStatus status = http_parser_execute(&conn->parser, input_buffer_data(&conn->in), input_buffer_length(&conn->in));
+        if (status == HTTP_PARSE_INCOMPLETE) {
+            return 0;
+        }
+        conn->state = CONNECTION_READING_BODY;
+        connection_begin_body(conn);
     }
+    return conn->error_status != 0 || connection_read_body(conn);
+}
 
-    FILE *fp = fopen(path, "r");
-    char *bytes = NULL;
+// Empty blocks are left out, so every element written moves the response forward
+void connection_push_iov(Connection *conn, const char *data, size_t length) {
+    if (length > 0) {
+        conn->iov[conn->iov_count++] = (struct iovec) {.iov_base = (void*) data, .iov_len = length};
+    }
+}
 
-    if (fp == NULL) {
-        return NULL;
-    };
+void connection_respond(EventLoop *loop, Connection *conn) {
+    HttpRes res;
+    // HEAD responses have the headers of the GET response, Content-Length included, but no body
+    int head = 0;
+    Arena *previous = arena_use(&conn->arena);
+    conn->requests++;
+    if (conn->error_status == 0) {
+        HttpReq *req = http_parser_request(&conn->parser, input_buffer_data(&conn->in));
+        req->body = (StringView) {.data = conn->body.fd < 0 ? conn->body.data : NULL, .length = conn->body.length};
+        req->body_fd = conn->body.fd;
+        res = handle_request(req, loop->config);
+        head = sv_equals(req->method, sv_cstr("HEAD"));
+        conn->keep_alive = http_request_keep_alive(req) && conn->requests < loop->config->max_requests;
+    }
+    else {
+        // The rest of the stream can't be framed, so the connection is closed after the error
+        res = http_response_new(conn->error_status);
+        conn->keep_alive = 0;
+    }
+    char *keep_alive = loop->config->keep_alive_headers;
+    StringView connection = conn->keep_alive ? (StringView) {.data = keep_alive, .length = vector_length(keep_alive)} : sv_cstr("Connection: close\r\n");
+    conn->out = http_response_head(&res);
+    conn->out_body = res.body;
+    conn->iov_count = 0;
+    conn->iov_next = 0;
+    StringView status_line = http_status_line(res.status_code);
+    connection_push_iov(conn, status_line.data, status_line.length);
+    connection_push_iov(conn, conn->out, vector_length(conn->out));
+    connection_push_iov(conn, connection.data, connection.length);
+    if (res.entry != NULL) {
+        connection_push_iov(conn, res.entry->headers, res.ranged ? res.entry->content_length_offset : vector_length(res.entry->headers));
+    }
+    connection_push_iov(conn, "\r\n", 2);
+    if (head) {
+        // Nothing follows the blank line
+    }
+    else if (res.entry != NULL) {
+        HttpRange range = res.ranged ? res.range : (HttpRange) {.offset = 0, .length = res.entry->size};
+        connection_push_iov(conn, res.entry->data + range.offset, range.length);
+    }
+    else {
+        connection_push_iov(conn, conn->out_body, vector_length(conn->out_body));
+    }
+    conn->file_fd = res.file_fd;
+    conn->file_offset = res.ranged ? res.range.offset : 0;
+    conn->file_remaining = res.file_fd < 0 || head ? 0 : res.ranged ? res.range.length : res.file_size;
+    conn->entry = res.entry;
+    conn->stream = res.stream;
+    res.stream = NULL;
+    res.file_fd = -1;
+    res.entry = NULL;
+    res.body = NULL;
+    http_response_free(&res);
+    arena_use(previous);
+    conn->state = CONNECTION_WRITING_RESPONSE;
+    stats_add(loop->stats.requests, 1);
+}
 
-    vector_ensure_capacity(bytes, size);
+// Drops the request that was just answered, keeping any pipelined bytes that followed it
+void connection_next_request(Connection *conn) {
+    // The body was already moved out of the buffer while it was read
+    input_buffer_consume(&conn->in, conn->parser.header_length);
+    http_parser_reset(&conn->parser);
+    request_body_reset(&conn->body);
+    conn->body_remaining = 0;
+    conn->error_status = 0;
+    vector_free(conn->out);
+    vector_free(conn->out_body);
+    arena_reset(&conn->arena);
+    conn->iov_count = 0;
+    conn->iov_next = 0;
+    conn->chunk_length = 0;
+    conn->chunk_sent = 0;
+    compress_stream_free(conn->stream);
+    conn->stream = NULL;
+    conn->stream_available = 0;
+    conn->stream_done = 0;
+    if (conn->file_fd >= 0) {
+        close(conn->file_fd);
+        conn->file_fd = -1;
+    }
+    if (conn->entry != NULL) {
+        file_cache_release(conn->entry);
+        conn->entry = NULL;
+    }
+    conn->state = CONNECTION_READING_HEADERS;
+}
 
-    long read = 0;
-    do {
-        int l = fread(bytes, sizeof(char), size, fp);
-        if (l < 0) break;
-        read += l;
-    } while(read < size);
-    vector_header(bytes)->length = read;
-    fclose(fp);
-    return bytes;
+// Moves the connection state machine forward until it would block. Returns -1 when the connection must be closed.
+int connection_process(EventLoop *loop, Connection *conn) {
+    while (1) {
+        if (conn->state == CONNECTION_READING_HEADERS || conn->state == CONNECTION_READING_BODY) {
+            int r = 0;
+            if (!conn->peer_closed) {
+                r = connection_read(conn);
+                if (r < 0) {
+                    return -1;
+                }
+                conn->peer_closed = r == 1;
+            }
+            if (!connection_request_ready(conn)) {
+                if (r == 2) {
+                    continue; // The request consumed the buffered bytes, the rest is still in the socket
+                }
+                return conn->peer_closed ? -1 : 0; // Peer closed before sending a whole request
+            }
+            connection_respond(loop, conn);
+        }
+        if (conn->state == CONNECTION_WRITING_RESPONSE) {
+            int r = connection_write(loop, conn);
+            if (r <= 0) {
+                return r;
+            }
+            if (conn->keep_alive) {
+                connection_next_request(conn);
+                continue;
+            }
+            shutdown(conn->fd, SHUT_WR);
+            conn->state = CONNECTION_DRAINING;
+        }
+        if (conn->state == CONNECTION_DRAINING) {
+            return connection_drain(conn) != 0 ? -1 : 0;
+        }
+    }
 }
 
-char *not_found_body(const char *path) {
-    char *body = string_format("<html><head><title>Page not found</title></head><body><h1>Page not found</h1><p>Page %s not found</p></body></html>", path);
-    return body;
+void event_loop_accept(EventLoop *loop) {
+    while (1) {
+        int fd = accept4(loop->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                perror("accept");
+            }
+            return;
+        }
+        Connection *conn = connection_open(loop, fd);
+        if (conn == NULL) {
+            close(fd);
+            continue;
+        }
+        if (connection_process(loop, conn) < 0) {
+            connection_close(loop, conn);
+        }
+    }
 }
 
-char *get_file_mime_type(const char *path) {
-    char *out;
-    char absolute_path[PATH_MAX];
-    path = realpath(path, absolute_path);
-    int status = process_sync((char *[]) {"file", "-i", (char*) path, NULL}, NULL, &out, NULL);
-    (void) status;
-
-    char *mime = NULL;
-    for (int i = 0; i < strlen(out); i++) {
-        if (out[i] == ':'){
-            out[strlen(out) - 1] = '\0';
-            string_push_cstr(mime, out + i + 2);
+void event_loop_expire(EventLoop *loop) {
+    long now = now_ms();
+    while (loop->head != NULL && now - loop->head->last_activity >= loop->config->idle_timeout_ms) {
+        connection_close(loop, loop->head);
+    }
+}
+
+int event_loop_run(EventLoop *loop) {
+    loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (loop->epoll_fd < 0) {
+        perror("epoll_create1");
+        return -1;
+    }
+    // The listening socket is level-triggered so pending connections are not lost if accept fails
+    struct epoll_event ev = {.events = EPOLLIN, .data.ptr = NULL};
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, loop->listen_fd, &ev) < 0) {
+        perror("epoll_ctl");
+        close(loop->epoll_fd);
+        return -1;
+    }
+    // The shutdown eventfd is shared by all workers and is identified by the loop itself
+    ev = (struct epoll_event) {.events = EPOLLIN, .data.ptr = loop};
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, loop->shutdown_fd, &ev) < 0) {
+        perror("epoll_ctl");
+        close(loop->epoll_fd);
+        return -1;
+    }
+
+    struct epoll_event events[MAX_EVENTS];
+    int running = 1;
+    while (running) {
+        int n = epoll_wait(loop->epoll_fd, events, MAX_EVENTS, 1000);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait");
             break;
         }
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.ptr == loop) {
+                running = 0;
+                continue;
+            }
+            Connection *conn = events[i].data.ptr;
+            if (conn == NULL) {
+                event_loop_accept(loop);
+                continue;
+            }
+            if (events[i].events & EPOLLERR || connection_process(loop, conn) < 0) {
+                connection_close(loop, conn);
+            }
+            else {
+                connection_touch(loop, conn);
+            }
+        }
+        event_loop_expire(loop);
+    }
+
+    while (loop->head != NULL) {
+        connection_close(loop, loop->head);
     }
-    free(out);
-    return mime;
+    close(loop->epoll_fd);
+    return 0;
 }
 
-HttpRes handle_request(HttpReq *req, char *folder) {
-    HttpRes res = {.status_code = 200};
-    res.headers = hashmap(http_header_free);
-    char *path = NULL;
-    char *body = NULL;
-    string_push_cstr(path, folder);
-    if (0 == strcmp(req->path, "/")) {
-        string_push_cstr(path, "/index.html");
-        body = read_entire_file(path);
+// io_uring user_data: the connection with the operation in the low bits, which calloc alignment leaves free
+typedef enum {
+    URING_OP_IGNORE,
+    URING_OP_ACCEPT,
+    URING_OP_SHUTDOWN,
+    URING_OP_RECV,
+    URING_OP_SEND,
+    URING_OP_FILE_READ,
+    URING_OP_FILE_SEND,
+} UringOp;
+
+#define URING_OP_MASK 7ull
+
+unsigned long long connection_user_data(Connection *conn, UringOp op) {
+    return (unsigned long long) (uintptr_t) conn | op;
+}
+
+// Queues an operation of conn, it is counted until its last completion
+struct io_uring_sqe *connection_sqe(EventLoop *loop, Connection *conn, UringOp op) {
+    struct io_uring_sqe *sqe = uring_get_sqe(loop->ring);
+    if (sqe != NULL) {
+        sqe->user_data = connection_user_data(conn, op);
+        conn->uring_pending++;
     }
-    else {
-        string_push(path, req->path);
-        body = read_entire_file(path);
+    return sqe;
+}
+
+// Keeps a multishot receive armed while there is room in the input buffer
+int connection_arm_recv(EventLoop *loop, Connection *conn) {
+    int full = input_buffer_length(&conn->in) >= RECV_BUFFER_LIMIT;
+    if (!conn->recv_armed && !conn->peer_closed && !full) {
+        struct io_uring_sqe *sqe = connection_sqe(loop, conn, URING_OP_RECV);
+        if (sqe == NULL) {
+            return -1;
+        }
+        uring_prep_recv_multishot(sqe, conn->fd);
+        conn->recv_armed = 1;
     }
-    if (body == NULL) {
-        res.status_code = 404;
-        res.body = not_found_body(req->path);
+    else if (conn->recv_armed && !conn->recv_paused && full) {
+        struct io_uring_sqe *sqe = uring_get_sqe(loop->ring);
+        if (sqe == NULL) {
+            return -1;
+        }
+        uring_prep_cancel(sqe, connection_user_data(conn, URING_OP_RECV));
+        sqe->user_data = connection_user_data(NULL, URING_OP_IGNORE);
+        conn->recv_paused = 1;
+    }
+    return 0;
+}
+
+int connection_send_response(EventLoop *loop, Connection *conn) {
+    struct io_uring_sqe *sqe = connection_sqe(loop, conn, URING_OP_SEND);
+    if (sqe == NULL) {
+        return -1;
+    }
+    conn->msg = (struct msghdr) {.msg_iov = conn->iov + conn->iov_next, .msg_iovlen = conn->iov_count - conn->iov_next};
+    uring_prep_sendmsg(sqe, conn->fd, &conn->msg, MSG_NOSIGNAL | (conn->file_remaining > 0 ? MSG_MORE : 0));
+    conn->sending = 1;
+    return 0;
+}
+
+// Reads the next chunk of the file and sends it in the same submission, the send only starts once the read completed.
+// A short read cancels the send, then the part that was read is sent on its own.
+int connection_send_file(EventLoop *loop, Connection *conn) {
+    if (conn->chunk_sent < conn->chunk_length) {
+        struct io_uring_sqe *sqe = connection_sqe(loop, conn, URING_OP_FILE_SEND);
+        if (sqe == NULL) {
+            return -1;
+        }
+        int flags = MSG_NOSIGNAL | (conn->file_remaining > 0 ? MSG_MORE : 0);
+        uring_prep_send(sqe, conn->fd, conn->file_chunk + conn->chunk_sent, conn->chunk_length - conn->chunk_sent, flags);
+        conn->sending = 1;
+        return 0;
+    }
+    if (conn->file_chunk == NULL) {
+        conn->file_chunk = malloc(FILE_CHUNK_SIZE);
+        if (conn->file_chunk == NULL) {
+            return -1;
+        }
+    }
+    size_t length = conn->file_remaining < FILE_CHUNK_SIZE ? conn->file_remaining : FILE_CHUNK_SIZE;
+    if (uring_reserve(loop->ring, 2) < 0) {
+        return -1;
+    }
+    struct io_uring_sqe *sqe = connection_sqe(loop, conn, URING_OP_FILE_READ);
+    uring_prep_read(sqe, conn->file_fd, conn->file_chunk, length, conn->file_offset);
+    sqe->flags |= IOSQE_IO_LINK;
+    sqe = connection_sqe(loop, conn, URING_OP_FILE_SEND);
+    uring_prep_send(sqe, conn->fd, conn->file_chunk, length, MSG_NOSIGNAL | (conn->file_remaining > length ? MSG_MORE : 0));
+    conn->chunk_length = 0;
+    conn->chunk_sent = 0;
+    conn->sending = 1;
+    return 0;
+}
+
+// Sends the rest of the current chunk of a streamed response, producing the next one first when it was all sent
+int connection_send_stream(EventLoop *loop, Connection *conn) {
+    if (conn->chunk_sent == conn->chunk_length && connection_fill_stream(conn) < 0) {
+        return -1;
+    }
+    struct io_uring_sqe *sqe = connection_sqe(loop, conn, URING_OP_FILE_SEND);
+    if (sqe == NULL) {
+        return -1;
+    }
+    uring_prep_send(sqe, conn->fd, conn->file_chunk + conn->chunk_sent, conn->chunk_length - conn->chunk_sent, MSG_NOSIGNAL);
+    conn->sending = 1;
+    return 0;
+}
+
+// The io_uring counterpart of connection_process: runs the state machine on the bytes received so far and queues
+// the sends. Returns -1 when the connection must be closed.
+int connection_process_uring(EventLoop *loop, Connection *conn) {
+    while (1) {
+        if (conn->state == CONNECTION_READING_HEADERS || conn->state == CONNECTION_READING_BODY) {
+            if (!connection_request_ready(conn)) {
+                return conn->peer_closed ? -1 : 0;
+            }
+            connection_respond(loop, conn);
+        }
+        if (conn->state == CONNECTION_WRITING_RESPONSE) {
+            if (conn->sending) {
+                return 0;
+            }
+            if (conn->iov_next < conn->iov_count) {
+                return connection_send_response(loop, conn);
+            }
+            if (conn->stream != NULL) {
+                if (connection_streaming(conn)) {
+                    return connection_send_stream(loop, conn);
+                }
+            }
+            else if (conn->chunk_sent < conn->chunk_length || conn->file_remaining > 0) {
+                return connection_send_file(loop, conn);
+            }
+            if (conn->keep_alive) {
+                connection_next_request(conn);
+                continue;
+            }
+            shutdown(conn->fd, SHUT_WR);
+            conn->state = CONNECTION_DRAINING;
+        }
+        if (conn->state == CONNECTION_DRAINING) {
+            return conn->peer_closed ? -1 : 0;
+        }
+    }
+}
+
+// Copies what was received to the input buffer, returns -1 if the receive failed
+int connection_received(EventLoop *loop, Connection *conn, struct io_uring_cqe *cqe) {
+    if (!(cqe->flags & IORING_CQE_F_MORE)) {
+        conn->recv_armed = 0;
+        conn->recv_paused = 0;
+    }
+    if (cqe->flags & IORING_CQE_F_BUFFER) {
+        unsigned id = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+        // Bytes sent after the response of a closing connection are discarded
+        if (cqe->res > 0 && !conn->closing && conn->state != CONNECTION_DRAINING) {
+            input_buffer_append(&conn->in, uring_buffer(loop->ring, id), cqe->res);
+        }
+        uring_buffer_recycle(loop->ring, id);
+    }
+    if (cqe->res == 0) {
+        conn->peer_closed = 1;
+    }
+    // Running out of buffers only stops the receive, it is armed again after the data is processed
+    return cqe->res < 0 && cqe->res != -ENOBUFS && cqe->res != -ECANCELED ? -1 : 0;
+}
+
+int connection_sent(EventLoop *loop, Connection *conn, struct io_uring_cqe *cqe, UringOp op) {
+    if (op == URING_OP_FILE_READ) {
+        // The linked send is still pending
+        if (cqe->res > 0) {
+            conn->chunk_length = cqe->res;
+            conn->file_offset += cqe->res;
+            conn->file_remaining -= cqe->res;
+        }
+        return 0;
+    }
+    conn->sending = 0;
+    if (op == URING_OP_FILE_SEND && cqe->res == -ECANCELED) {
+        // A read error, or the file was truncated after the headers were sent, when nothing was read
+        return conn->chunk_length > 0 ? 0 : -1;
+    }
+    if (cqe->res < 0) {
+        return -1;
+    }
+    if (op == URING_OP_SEND) {
+        connection_advance_iov(conn, cqe->res);
     }
     else {
-        string_hashmap_push(res.headers, string_format("Content-Type"), get_file_mime_type(path));
-        res.body = body;
+        conn->chunk_sent += cqe->res;
     }
-    string_hashmap_push(res.headers, string_format("Connection"), string_format("close"));
-    vector_free(path);
-    return res;
+    stats_add(loop->stats.bytes_sent, cqe->res);
+    return 0;
 }
 
-void http_request_free(HttpReq *req) {
-    vector_free(req->protocol);
-    vector_free(req->body);
-    vector_free(req->path);
-    hashmap_free(req->headers);
+int event_loop_arm_accept(EventLoop *loop) {
+    struct io_uring_sqe *sqe = uring_get_sqe(loop->ring);
+    if (sqe == NULL) {
+        return -1;
+    }
+    // The sockets stay blocking, io_uring waits for them without holding up the worker
+    uring_prep_accept_multishot(sqe, loop->listen_fd, SOCK_CLOEXEC);
+    sqe->user_data = connection_user_data(NULL, URING_OP_ACCEPT);
+    return 0;
 }
 
-void http_response_free(HttpRes *res) {
-    vector_free(res->body);
-    hashmap_free(res->headers);
+void event_loop_accepted(EventLoop *loop, struct io_uring_cqe *cqe, int running) {
+    if (!(cqe->flags & IORING_CQE_F_MORE) && running && event_loop_arm_accept(loop) < 0) {
+        fprintf(stderr, "Worker stopped accepting connections\n");
+    }
+    if (cqe->res < 0) {
+        if (cqe->res != -ECONNABORTED && cqe->res != -ECANCELED) {
+            fprintf(stderr, "accept: %s\n", strerror(-cqe->res));
+        }
+        return;
+    }
+    if (!running) {
+        close(cqe->res);
+        return;
+    }
+    Connection *conn = connection_open(loop, cqe->res);
+    if (conn == NULL) {
+        close(cqe->res);
+        return;
+    }
+    if (connection_arm_recv(loop, conn) < 0) {
+        connection_close(loop, conn);
+    }
+}
+
+void event_loop_complete(EventLoop *loop, struct io_uring_cqe *cqe, int *running) {
+    UringOp op = cqe->user_data & URING_OP_MASK;
+    Connection *conn = (Connection*) (uintptr_t) (cqe->user_data & ~URING_OP_MASK);
+    switch (op) {
+        case URING_OP_IGNORE:
+            return;
+        case URING_OP_ACCEPT:
+            event_loop_accepted(loop, cqe, *running);
+            return;
+        case URING_OP_SHUTDOWN:
+            *running = 0;
+            return;
+        default:
+            break;
+    }
+    if (!(cqe->flags & IORING_CQE_F_MORE)) {
+        conn->uring_pending--;
+    }
+    int r = op == URING_OP_RECV ? connection_received(loop, conn, cqe) : connection_sent(loop, conn, cqe, op);
+    if (conn->closing) {
+        if (conn->uring_pending == 0) {
+            loop->closing--;
+            connection_free(loop, conn);
+        }
+        return;
+    }
+    if (r < 0 || connection_process_uring(loop, conn) < 0 || connection_arm_recv(loop, conn) < 0) {
+        connection_close(loop, conn);
+    }
+    else {
+        connection_touch(loop, conn);
+    }
 }
 
+// Same as event_loop_run with io_uring: accepts and receives are multishot, so a worker mostly waits in a single
+// io_uring_enter that also submits the sends queued while handling the previous completions.
+// Returns -1 if io_uring can't be used.
+int event_loop_run_uring(EventLoop *loop) {
+    Uring ring;
+    if (uring_init(&ring, URING_ENTRIES, URING_BUFFER_COUNT, RECV_CHUNK_SIZE) < 0) {
+        return -1;
+    }
+    loop->ring = &ring;
+    struct io_uring_sqe *sqe = uring_get_sqe(&ring);
+    uring_prep_poll(sqe, loop->shutdown_fd, POLLIN);
+    sqe->user_data = connection_user_data(NULL, URING_OP_SHUTDOWN);
+    if (event_loop_arm_accept(loop) < 0) {
+        loop->ring = NULL;
+        uring_destroy(&ring);
+        return -1;
+    }
 
-static int sock;
-void sighandler(int signal) {
-    shutdown(sock, SHUT_RDWR);
-    printf("Exiting the program...\n");
+    int running = 1;
+    while (running || loop->closing > 0) {
+        if (uring_submit_and_wait(&ring, 1000) < 0) {
+            break;
+        }
+        struct io_uring_cqe *cqe;
+        while ((cqe = uring_peek_cqe(&ring)) != NULL) {
+            struct io_uring_cqe completion = *cqe;
+            uring_cqe_seen(&ring);
+            event_loop_complete(loop, &completion, &running);
+        }
+        if (running) {
+            event_loop_expire(loop);
+        }
+        while (!running && loop->head != NULL) {
+            connection_close(loop, loop->head);
+        }
+    }
+
+    while (loop->head != NULL) {
+        connection_close(loop, loop->head);
+    }
+    uring_destroy(&ring);
+    loop->ring = NULL;
+    return 0;
 }
 
-void close_safe(int fd) {
-    shutdown(fd, SHUT_WR);
-    char buf[1024];
-    int r;
-    do {
-        r = read(fd, buf, 1024);
-    } while(r > 0);
-    close(fd);
+void *worker_run(void *arg) {
+    Worker *worker = (Worker*) arg;
+    if (worker->loop.config->io_uring) {
+        if (event_loop_run_uring(&worker->loop) == 0) {
+            return NULL;
+        }
+        fprintf(stderr, "Worker %d: io_uring is not available (%s), using epoll\n", worker->id, strerror(errno));
+    }
+    event_loop_run(&worker->loop);
+    return NULL;
+}
+
+void print_worker_stats(Worker *workers, int count) {
+    for (int i = 0; i < count; i++) {
+        WorkerStats *stats = &workers[i].loop.stats;
+        printf("Worker %d: %lu accepted, %lu active, %lu requests, %lu bytes sent\n", workers[i].id,
+            stats_load(stats->accepted), stats_load(stats->active), stats_load(stats->requests), stats_load(stats->bytes_sent));
+    }
+    fflush(stdout);
+}
+
+int listen_socket(long port, int reuse_port) {
+    int sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (sock < 0) {
+        perror("socket");
+        return -1;
+    }
+    struct sockaddr_in addr = {.sin_family = AF_INET, .sin_port = htons((short) port), .sin_addr = {.s_addr = htonl(INADDR_ANY)}};
+
+    int reuse = 1;
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    // Every worker has its own listening socket, so the kernel balances connections without a shared accept queue
+    if (reuse_port && setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse)) < 0) {
+        perror("setsockopt");
+        close(sock);
+        return -1;
+    }
+    if (bind(sock, (struct sockaddr*) &addr, sizeof(addr)) < 0) {
+        perror("bind");
+        close(sock);
+        return -1;
+    }
+    if (listen(sock, SOMAXCONN) < 0) {
+        perror("listen");
+        close(sock);
+        return -1;
+    }
+    return sock;
 }
 
 int main (int argc, char *argv[]) {
     int ret = 0;
+    int shutdown_fd = -1;
+    ServerConfig config = {.idle_timeout_ms = DEFAULT_IDLE_TIMEOUT * 1000, .max_requests = DEFAULT_MAX_REQUESTS};
+    Worker *workers = NULL;
+    int started = 0;
     struct option *options = NULL;
     struct option opt =  {.name = "port", .val = 'p', .flag = NULL, .has_arg = 1};
     vector_push(options, opt);
@@ -241,93 +1476,221 @@ int main (int argc, char *argv[]) {
     vector_push(options, opt);
     opt = (struct option) {.name = "files", .val = 'f', .flag = NULL, .has_arg = 1 };
     vector_push(options, opt);
+    opt = (struct option) {.name = "workers", .val = 'w', .flag = NULL, .has_arg = 1 };
+    vector_push(options, opt);
+    opt = (struct option) {.name = "idle-timeout", .val = 't', .flag = NULL, .has_arg = 1 };
+    vector_push(options, opt);
+    opt = (struct option) {.name = "max-requests", .val = 'm', .flag = NULL, .has_arg = 1 };
+    vector_push(options, opt);
+    opt = (struct option) {.name = "mime-types", .val = 'M', .flag = NULL, .has_arg = 2 };
+    vector_push(options, opt);
+    opt = (struct option) {.name = "sniff-mime", .val = 's', .flag = NULL, .has_arg = 0 };
+    vector_push(options, opt);
+    opt = (struct option) {.name = "cache-size", .val = 'c', .flag = NULL, .has_arg = 1 };
+    vector_push(options, opt);
+    opt = (struct option) {.name = "io", .val = 'i', .flag = NULL, .has_arg = 1 };
+    vector_push(options, opt);
+    opt = (struct option) {.name = "cache-control", .val = 'C', .flag = NULL, .has_arg = 1 };
+    vector_push(options, opt);
     opt = (struct option) {0};
     vector_push(options, opt);
 
-    struct sigaction act = {.sa_handler = sighandler, .sa_flags = SA_RESTART | SA_NOCLDSTOP};
-    sigaction(SIGINT, &act, NULL);
+    // Signals are blocked in every thread and handled synchronously by the main thread
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+    struct sigaction act = {.sa_handler = SIG_IGN};
+    sigaction(SIGPIPE, &act, NULL);
 
     long port = 8080;
-    char *files = NULL;
+    long worker_count = 1;
+    long cache_size = FILE_CACHE_DEFAULT_SIZE;
     char *end = NULL;
     char o;
-    while ((o = getopt_long(argc, argv, "hp:f:", options, NULL)) > 0) {
+    while ((o = getopt_long(argc, argv, "hp:f:w:t:m:M::sc:i:C:", options, NULL)) > 0) {
         switch (o) {
             case 'p':
                 port = strtol(argv[optind - 1], &end, 10);
                 if (port <= 0 || port > SHRT_MAX || *end != '\0') {
                     fprintf(stderr, "Invalid port: %s\n", argv[optind - 1]);
-                    fprintf(stderr, "Usage: %s [-h] [-p PORT] -f PATH\n", argv[0]);
+                    fprintf(stderr, "Usage: %s [-h] [-p PORT] [-w WORKERS] -f PATH\n", argv[0]);
                     defer_return(1);
                 }
                 break;
             case 'f':
-                files = argv[optind - 1];
+                config.files = argv[optind - 1];
+                break;
+            case 'w':
+                worker_count = strtol(argv[optind - 1], &end, 10);
+                if (worker_count <= 0 || worker_count > MAX_WORKERS || *end != '\0') {
+                    fprintf(stderr, "Invalid number of workers: %s\n", argv[optind - 1]);
+                    fprintf(stderr, "Usage: %s [-h] [-p PORT] [-w WORKERS] -f PATH\n", argv[0]);
+                    defer_return(1);
+                }
+                break;
+            case 't':
+                config.idle_timeout_ms = strtol(argv[optind - 1], &end, 10) * 1000;
+                if (config.idle_timeout_ms <= 0 || *end != '\0') {
+                    fprintf(stderr, "Invalid idle timeout: %s\n", argv[optind - 1]);
+                    fprintf(stderr, "Usage: %s [-h] [-p PORT] [-w WORKERS] -f PATH\n", argv[0]);
+                    defer_return(1);
+                }
+                break;
+            case 'm':
+                config.max_requests = strtol(argv[optind - 1], &end, 10);
+                if (config.max_requests <= 0 || *end != '\0') {
+                    fprintf(stderr, "Invalid number of requests: %s\n", argv[optind - 1]);
+                    fprintf(stderr, "Usage: %s [-h] [-p PORT] [-w WORKERS] -f PATH\n", argv[0]);
+                    defer_return(1);
+                }
+                break;
+            case 'M':
+                if (mime_load_types(optarg != NULL ? optarg : "/etc/mime.types") < 0) {
+                    perror("mime-types");
+                    defer_return(1);
+                }
                 break;
+            case 's':
+                mime_enable_sniffing();
+                break;
+            case 'c':
+                cache_size = strtol(argv[optind - 1], &end, 10);
+                switch (*end) {
+                    case 'G': case 'g': cache_size *= 1024; // fallthrough
+                    case 'M': case 'm': cache_size *= 1024; // fallthrough
+                    case 'K': case 'k': cache_size *= 1024; end++; break;
+                }
+                if (cache_size < 0 || *end != '\0') {
+                    fprintf(stderr, "Invalid cache size: %s\n", argv[optind - 1]);
+                    fprintf(stderr, "Usage: %s [-h] [-p PORT] [-w WORKERS] -f PATH\n", argv[0]);
+                    defer_return(1);
+                }
+                break;
+            case 'i':
+                if (strcmp(optarg, "uring") == 0) {
+                    config.io_uring = 1;
+                }
+                else if (strcmp(optarg, "epoll") == 0) {
+                    config.io_uring = 0;
+                }
+                else {
+                    fprintf(stderr, "Invalid I/O engine: %s\n", optarg);
+                    fprintf(stderr, "Usage: %s [-h] [-p PORT] [-w WORKERS] -f PATH\n", argv[0]);
+                    defer_return(1);
+                }
+                break;
+            case 'C': {
+                char *value = strchr(optarg, '=');
+                if (value == NULL || optarg[0] != '/') {
+                    fprintf(stderr, "Invalid Cache-Control rule: %s\n", optarg);
+                    fprintf(stderr, "Usage: %s [-h] [-p PORT] [-w WORKERS] -f PATH\n", argv[0]);
+                    defer_return(1);
+                }
+                *value = '\0';
+                CacheControlRule rule = {.prefix = optarg, .value = value + 1};
+                vector_push(config.cache_control, rule);
+                break;
+            }
             case 'h':
-                printf("Usage: %s [-h] [-p PORT] -f PATH\n", argv[0]);
+                printf("Usage: %s [-h] [-p PORT] [-w WORKERS] -f PATH\n", argv[0]);
                 printf("Options:\n");
-                printf("\t-h\t--help      \tShow this help menu\n");
-                printf("\t-p\t--port=PORT \tSpecify the port to be used. Defaults to 8080\n");
-                printf("\t-f\t--files=PATH\tSpecify the folder containing the static files to be exposed by the server\n");
+                printf("\t-h\t--help                \tShow this help menu\n");
+                printf("\t-p\t--port=PORT           \tSpecify the port to be used. Defaults to 8080\n");
+                printf("\t-f\t--files=PATH          \tSpecify the folder containing the static files to be exposed by the server\n");
+                printf("\t-w\t--workers=COUNT       \tSpecify the number of worker threads, each one with its own listening socket. Defaults to 1\n");
+                printf("\t-t\t--idle-timeout=SECONDS\tClose connections idle for longer than this. Defaults to %d\n", DEFAULT_IDLE_TIMEOUT);
+                printf("\t-m\t--max-requests=COUNT  \tClose persistent connections after serving this many requests. Defaults to %d\n", DEFAULT_MAX_REQUESTS);
+                printf("\t-M\t--mime-types[=PATH]   \tAdd the extensions listed in a mime.types file. Defaults to /etc/mime.types\n");
+                printf("\t-s\t--sniff-mime          \tDetect the type of files with unknown extensions using `file -i`\n");
+                printf("\t-c\t--cache-size=SIZE     \tMemory used to cache small files, accepts K, M and G suffixes. 0 disables the cache. Defaults to 64M\n");
+                printf("\t-i\t--io=ENGINE           \tUse epoll or uring for the network I/O. uring falls back to epoll when it is not available. Defaults to epoll\n");
+                printf("\t-C\t--cache-control=PREFIX=VALUE\tSend Cache-Control: VALUE for the paths starting with PREFIX. The longest prefix wins, can be repeated\n");
+                printf("Send SIGUSR1 to print the per-worker statistics\n");
                 break;
             default:
-                fprintf(stderr, "Usage: %s [-h] [-p PORT] -f PATH\n", argv[0]);
+                fprintf(stderr, "Usage: %s [-h] [-p PORT] [-w WORKERS] -f PATH\n", argv[0]);
                 defer_return(1);
         }
     }
-    if (files == NULL) {
-        fprintf(stderr, "Usage: %s [-h] [-p PORT] -f PATH\n", argv[0]);
+    if (config.files == NULL) {
+        fprintf(stderr, "Usage: %s [-h] [-p PORT] [-w WORKERS] -f PATH\n", argv[0]);
         defer_return(1);
     }
-
-    sock = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
-    struct sockaddr_in addr = {.sin_family = AF_INET, .sin_port = htons((short) port), .sin_addr = {.s_addr = htonl(INADDR_ANY)}};
-    struct sockaddr_in client_addr;
-    socklen_t client_addr_len = sizeof(client_addr);
-        
-    if (bind(sock, (struct sockaddr*) &addr, sizeof(addr)) < 0) {
-        perror("bind");
+    // Paths are built as folder + request path, a trailing slash would make cache keys differ from inotify paths
+    for (size_t l = strlen(config.files); l > 1 && config.files[l - 1] == '/'; l--) {
+        config.files[l - 1] = '\0';
+    }
+    if (file_cache_init(config.files, cache_size) < 0) {
         defer_return(1);
     }
-    if (listen(sock, 100) < 0) {
-        perror("listen");
+
+    config.keep_alive_headers = string_format("Connection: keep-alive\r\nKeep-Alive: timeout=%ld\r\n", config.idle_timeout_ms / 1000);
+
+    shutdown_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (shutdown_fd < 0) {
+        perror("eventfd");
         defer_return(1);
     }
-    printf("Listening to port %d\n", (int) port);
+    workers = calloc(worker_count, sizeof(Worker));
+    for (int i = 0; i < worker_count; i++) {
+        workers[i].id = i;
+        workers[i].loop.config = &config;
+        workers[i].loop.shutdown_fd = shutdown_fd;
+        workers[i].loop.listen_fd = listen_socket(port, worker_count > 1);
+        if (workers[i].loop.listen_fd < 0) {
+            defer_return(1);
+        }
+    }
+    for (; started < worker_count; started++) {
+        int err = pthread_create(&workers[started].thread, NULL, worker_run, &workers[started]);
+        if (err != 0) {
+            fprintf(stderr, "pthread_create: %s\n", strerror(err));
+            defer_return(1);
+        }
+    }
+    printf("Listening to port %d with %d worker(s)\n", (int) port, (int) worker_count);
+    fflush(stdout);
 
-    int fd;
-    while ((fd = accept(sock, (struct sockaddr*) &client_addr, &client_addr_len)) > 0) {
-        char *msg = NULL;
-        int l;
-        struct pollfd fds = {.fd = fd, .events = POLLIN | POLLHUP };
-        do {
-            char buffer[1024] = {0};
-            l = recv(fd, buffer, 1024, 0);
-            (void)l;
-            string_push_cstr(msg, buffer);
-            if (poll(&fds, 1, 100) < 1) {
-                break;
-            }
-        } while(1);
-        HttpReq req = parse_http_request(msg);
-        HttpRes res = handle_request(&req, files);
-        char *res_bytes = http_response_to_bytes(&res);
-        send(fd, res_bytes, vector_length(res_bytes), 0);
-        
-        http_request_free(&req);
-        http_response_free(&res);
-        vector_free(res_bytes);
-        vector_free(msg);
-        close_safe(fd);
+    int sig;
+    while (sigwait(&signals, &sig) == 0) {
+        if (sig == SIGUSR1) {
+            print_worker_stats(workers, worker_count);
+            continue;
+        }
+        printf("Exiting the program...\n");
+        break;
     }
 
 defer:
-    if (sock > 0) {
-        if (close(sock) < 0) {
-            perror("close");
+    if (shutdown_fd >= 0) {
+        uint64_t one = 1;
+        if (write(shutdown_fd, &one, sizeof(one)) < 0) {
+            perror("write");
         }
     }
+    for (int i = 0; i < started; i++) {
+        pthread_join(workers[i].thread, NULL);
+    }
+    if (workers != NULL) {
+        if (started > 0) {
+            print_worker_stats(workers, worker_count);
+        }
+        for (int i = 0; i < worker_count; i++) {
+            if (workers[i].loop.listen_fd > 0 && close(workers[i].loop.listen_fd) < 0) {
+                perror("close");
+            }
+        }
+        free(workers);
+    }
+    if (shutdown_fd >= 0) {
+        close(shutdown_fd);
+    }
+    file_cache_shutdown();
+    vector_free(config.keep_alive_headers);
+    vector_free(config.cache_control);
     vector_free(options);
     return ret;
 }
@@ -0,0 +1,60 @@
+#!/usr/bin/env bash
+# A HEAD response must end with its headers: a GET pipelined after it has to read its own status line next.
+# usage: tests/head_pipeline.sh [SERVER_BINARY] [PORT]
+set -u
+SERVER=${1:-./server}
+PORT=${2:-18080}
+ROOT=$(mktemp -d)
+trap 'kill $PID 2>/dev/null; wait $PID 2>/dev/null; rm -rf "$ROOT"' EXIT
+printf 'hello\n' > "$ROOT/index.html"
+# Too big for the cache, so a GET accepting gzip is compressed while it is sent
+yes 'a line of text' | head -c 2000000 > "$ROOT/big.txt"
+"$SERVER" -p "$PORT" -f "$ROOT" > /dev/null 2>&1 &
+PID=$!
+for _ in $(seq 50); do
+    (exec 3<> "/dev/tcp/127.0.0.1/$PORT") 2> /dev/null && break
+    sleep 0.1
+done
+
+exec 3<> "/dev/tcp/127.0.0.1/$PORT"
+printf 'HEAD / HTTP/1.1\r\nHost: localhost\r\n\r\nGET / HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n' >&3
+RESPONSE=$(cat <&3 | tr -d '\r')
+exec 3<&-
+
+# The HEAD headers, a blank line, then the GET response and its body
+HEAD_BLOCK=${RESPONSE%%$'\n\n'*}
+REST=${RESPONSE#*$'\n\n'}
+fail() {
+    echo "FAIL: $1"
+    printf '%s\n' "$RESPONSE"
+    exit 1
+}
+[[ $HEAD_BLOCK == "HTTP/1.1 200 OK"* ]] || fail "HEAD status"
+[[ $HEAD_BLOCK == *"Content-Length: 6"* ]] || fail "HEAD Content-Length"
+[[ $REST == "HTTP/1.1 200 OK"* ]] || fail "GET status after HEAD"
+[[ $REST == *$'\n\nhello' ]] || fail "GET body"
+
+# HEAD gets the chunked gzip headers of the streamed GET and no body, so no chunk may follow them
+exec 3<> "/dev/tcp/127.0.0.1/$PORT"
+printf 'HEAD /big.txt HTTP/1.1\r\nHost: localhost\r\nAccept-Encoding: gzip\r\n\r\nGET / HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n' >&3
+RESPONSE=$(cat <&3 | tr -d '\r')
+exec 3<&-
+HEAD_BLOCK=${RESPONSE%%$'\n\n'*}
+REST=${RESPONSE#*$'\n\n'}
+[[ $HEAD_BLOCK == *"Transfer-Encoding: chunked"* && $HEAD_BLOCK == *"Content-Encoding: gzip"* ]] || fail "streamed HEAD headers"
+[[ $HEAD_BLOCK != *"Content-Length"* ]] || fail "streamed HEAD Content-Length"
+[[ $REST == "HTTP/1.1 200 OK"* ]] || fail "GET status after streamed HEAD"
+
+# A date with out of range fields is not a date, the condition is ignored and the file sent
+exec 3<> "/dev/tcp/127.0.0.1/$PORT"
+printf 'GET / HTTP/1.1\r\nHost: localhost\r\nIf-Modified-Since: Fri, 99 Oct 2099 99:99:99 GMT\r\nConnection: close\r\n\r\n' >&3
+RESPONSE=$(cat <&3 | tr -d '\r')
+exec 3<&-
+[[ $RESPONSE == "HTTP/1.1 200 OK"* ]] || fail "malformed If-Modified-Since"
+
+exec 3<> "/dev/tcp/127.0.0.1/$PORT"
+printf 'POST / HTTP/1.1\r\nHost: localhost\r\nContent-Length: 0\r\nConnection: close\r\n\r\n' >&3
+RESPONSE=$(cat <&3 | tr -d '\r')
+exec 3<&-
+[[ $RESPONSE == "HTTP/1.1 405 Method Not Allowed"* && $RESPONSE == *"Allow: GET, HEAD"* ]] || fail "POST"
+echo "PASS"
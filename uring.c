@@ -0,0 +1,250 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "uring.h"
+
+#define uring_load_acquire(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define uring_store_release(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+static int uring_enter(Uring *ring, unsigned submit, unsigned wait, unsigned flags, void *arg, size_t arg_size) {
+    return syscall(__NR_io_uring_enter, ring->fd, submit, wait, flags, arg, arg_size);
+}
+
+// Makes the queued entries visible to the kernel and returns how many there are
+static unsigned uring_flush(Uring *ring) {
+    unsigned pending = ring->sq_pending;
+    if (pending > 0) {
+        uring_store_release(ring->sq_tail, *ring->sq_tail + pending);
+        ring->sq_pending = 0;
+    }
+    return pending;
+}
+
+static int uring_setup(unsigned entries, struct io_uring_params *params) {
+    // Completions are only run when the worker waits for them, so they arrive in batches
+    memset(params, 0, sizeof(*params));
+    params->flags = IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL | IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN;
+    params->cq_entries = entries * 8;
+    int fd = syscall(__NR_io_uring_setup, entries, params);
+    if (fd >= 0 || errno != EINVAL) {
+        return fd;
+    }
+    // Kernels older than 6.1
+    memset(params, 0, sizeof(*params));
+    params->flags = IORING_SETUP_CQSIZE;
+    params->cq_entries = entries * 8;
+    return syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int uring_setup_buffers(Uring *ring, unsigned count, unsigned size) {
+    ring->buf_ring_size = count * sizeof(struct io_uring_buf);
+    ring->buf_ring = mmap(NULL, ring->buf_ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ring->buf_ring == MAP_FAILED) {
+        ring->buf_ring = NULL;
+        return -1;
+    }
+    ring->buffers = malloc((size_t) count * size);
+    if (ring->buffers == NULL) {
+        return -1;
+    }
+    ring->buf_count = count;
+    ring->buf_size = size;
+    struct io_uring_buf_reg reg = {.ring_addr = (unsigned long) ring->buf_ring, .ring_entries = count, .bgid = URING_BUFFER_GROUP};
+    if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        return -1;
+    }
+    for (unsigned i = 0; i < count; i++) {
+        uring_buffer_recycle(ring, i);
+    }
+    return 0;
+}
+
+int uring_init(Uring *ring, unsigned entries, unsigned buf_count, unsigned buf_size) {
+    memset(ring, 0, sizeof(*ring));
+    struct io_uring_params params;
+    ring->fd = uring_setup(entries, &params);
+    if (ring->fd < 0) {
+        return -1;
+    }
+    unsigned required = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG;
+    if ((params.features & required) != required) {
+        errno = ENOSYS;
+        uring_destroy(ring);
+        return -1;
+    }
+    // Both rings share one mapping
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (cq_size > ring->sq_ring_size) {
+        ring->sq_ring_size = cq_size;
+    }
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ring == MAP_FAILED) {
+        ring->sq_ring = NULL;
+        uring_destroy(ring);
+        return -1;
+    }
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        ring->sqes = NULL;
+        uring_destroy(ring);
+        return -1;
+    }
+    char *sq = ring->sq_ring;
+    ring->sq_head = (unsigned*) (sq + params.sq_off.head);
+    ring->sq_tail = (unsigned*) (sq + params.sq_off.tail);
+    ring->sq_mask = *(unsigned*) (sq + params.sq_off.ring_mask);
+    ring->sq_entries = params.sq_entries;
+    // Entries are always used in ring order, so the indirection array maps every slot to itself
+    unsigned *array = (unsigned*) (sq + params.sq_off.array);
+    for (unsigned i = 0; i < params.sq_entries; i++) {
+        array[i] = i;
+    }
+    ring->cq_head = (unsigned*) (sq + params.cq_off.head);
+    ring->cq_tail = (unsigned*) (sq + params.cq_off.tail);
+    ring->cq_mask = *(unsigned*) (sq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*) (sq + params.cq_off.cqes);
+    if (uring_setup_buffers(ring, buf_count, buf_size) < 0) {
+        uring_destroy(ring);
+        return -1;
+    }
+    return 0;
+}
+
+void uring_destroy(Uring *ring) {
+    if (ring->fd >= 0) {
+        close(ring->fd);
+    }
+    if (ring->sqes != NULL) {
+        munmap(ring->sqes, ring->sqes_size);
+    }
+    if (ring->sq_ring != NULL) {
+        munmap(ring->sq_ring, ring->sq_ring_size);
+    }
+    if (ring->buf_ring != NULL) {
+        munmap(ring->buf_ring, ring->buf_ring_size);
+    }
+    free(ring->buffers);
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = -1;
+}
+
+int uring_reserve(Uring *ring, unsigned count) {
+    unsigned tail = *ring->sq_tail + ring->sq_pending;
+    if (tail - uring_load_acquire(ring->sq_head) + count <= ring->sq_entries) {
+        return 0;
+    }
+    unsigned submit = uring_flush(ring);
+    while (uring_enter(ring, submit, 0, 0, NULL, 0) < 0) {
+        if (errno != EINTR) {
+            perror("io_uring_enter");
+            return -1;
+        }
+    }
+    return tail - uring_load_acquire(ring->sq_head) + count <= ring->sq_entries ? 0 : -1;
+}
+
+struct io_uring_sqe *uring_get_sqe(Uring *ring) {
+    if (uring_reserve(ring, 1) < 0) {
+        return NULL;
+    }
+    struct io_uring_sqe *sqe = &ring->sqes[(*ring->sq_tail + ring->sq_pending) & ring->sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sq_pending++;
+    return sqe;
+}
+
+int uring_submit_and_wait(Uring *ring, long timeout_ms) {
+    struct __kernel_timespec ts = {.tv_sec = timeout_ms / 1000, .tv_nsec = (timeout_ms % 1000) * 1000000};
+    struct io_uring_getevents_arg arg = {.ts = (unsigned long) &ts};
+    unsigned submit = uring_flush(ring);
+    if (uring_enter(ring, submit, 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg)) < 0) {
+        if (errno != EINTR && errno != ETIME && errno != EAGAIN && errno != EBUSY) {
+            perror("io_uring_enter");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+struct io_uring_cqe *uring_peek_cqe(Uring *ring) {
+    unsigned head = *ring->cq_head;
+    if (head == uring_load_acquire(ring->cq_tail)) {
+        return NULL;
+    }
+    return &ring->cqes[head & ring->cq_mask];
+}
+
+void uring_cqe_seen(Uring *ring) {
+    uring_store_release(ring->cq_head, *ring->cq_head + 1);
+}
+
+char *uring_buffer(Uring *ring, unsigned id) {
+    return ring->buffers + (size_t) id * ring->buf_size;
+}
+
+void uring_buffer_recycle(Uring *ring, unsigned id) {
+    struct io_uring_buf *buf = &ring->buf_ring->bufs[ring->buf_tail & (ring->buf_count - 1)];
+    buf->addr = (unsigned long) uring_buffer(ring, id);
+    buf->len = ring->buf_size;
+    buf->bid = id;
+    ring->buf_tail++;
+    uring_store_release(&ring->buf_ring->tail, (unsigned short) ring->buf_tail);
+}
+
+void uring_prep_accept_multishot(struct io_uring_sqe *sqe, int fd, int flags) {
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = flags;
+}
+
+void uring_prep_recv_multishot(struct io_uring_sqe *sqe, int fd) {
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUFFER_GROUP;
+}
+
+void uring_prep_sendmsg(struct io_uring_sqe *sqe, int fd, const struct msghdr *msg, int flags) {
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = fd;
+    sqe->addr = (unsigned long) msg;
+    sqe->len = 1;
+    sqe->msg_flags = flags;
+}
+
+void uring_prep_send(struct io_uring_sqe *sqe, int fd, const void *data, size_t length, int flags) {
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = fd;
+    sqe->addr = (unsigned long) data;
+    sqe->len = length;
+    sqe->msg_flags = flags;
+}
+
+void uring_prep_read(struct io_uring_sqe *sqe, int fd, void *data, size_t length, off_t offset) {
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = (unsigned long) data;
+    sqe->len = length;
+    sqe->off = offset;
+}
+
+void uring_prep_poll(struct io_uring_sqe *sqe, int fd, unsigned events) {
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = events;
+}
+
+void uring_prep_cancel(struct io_uring_sqe *sqe, unsigned long long user_data) {
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = user_data;
+}
@@ -0,0 +1,76 @@
+#ifndef URING_H
+#define URING_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <linux/io_uring.h>
+
+// An io_uring instance driven with the raw system calls, with a ring of provided buffers for receiving.
+// It is used from a single thread.
+typedef struct {
+    int fd;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned sq_mask;
+    unsigned sq_entries;
+    struct io_uring_sqe *sqes;
+    // Entries taken with uring_get_sqe and not handed to the kernel yet
+    unsigned sq_pending;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe *cqes;
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring;
+    size_t cq_ring_size;
+    size_t sqes_size;
+    struct io_uring_buf_ring *buf_ring;
+    size_t buf_ring_size;
+    char *buffers;
+    unsigned buf_count;
+    unsigned buf_size;
+    unsigned buf_tail;
+} Uring;
+
+// The group id of the provided buffers, used by uring_prep_recv_multishot
+#define URING_BUFFER_GROUP 0
+
+// Returns -1 when io_uring, or one of the features used here, is not available. buf_count must be a power of two.
+int uring_init(Uring *ring, unsigned entries, unsigned buf_count, unsigned buf_size);
+// Operations still in flight are cancelled, but they may use their buffers until they complete
+void uring_destroy(Uring *ring);
+
+// Submits the queued entries if fewer than count are free, so the next count entries go in the same submission.
+// Linked operations must be submitted together. Returns -1 if the entries can't be submitted.
+int uring_reserve(Uring *ring, unsigned count);
+
+// Returns a zeroed submission entry, submitting the queued ones first if the queue is full.
+// Returns NULL if they can't be submitted.
+struct io_uring_sqe *uring_get_sqe(Uring *ring);
+
+// Submits the queued entries and waits up to timeout_ms for at least one completion.
+// Returns -1 on errors other than an interruption or the timeout.
+int uring_submit_and_wait(Uring *ring, long timeout_ms);
+
+// Returns the next completion, or NULL when there is none. It stays valid until uring_cqe_seen.
+struct io_uring_cqe *uring_peek_cqe(Uring *ring);
+void uring_cqe_seen(Uring *ring);
+
+// The provided buffer a completion was received into
+char *uring_buffer(Uring *ring, unsigned id);
+// Gives a provided buffer back to the kernel once its data was copied out
+void uring_buffer_recycle(Uring *ring, unsigned id);
+
+void uring_prep_accept_multishot(struct io_uring_sqe *sqe, int fd, int flags);
+// Keeps receiving into provided buffers until it fails, the peer closes or the buffers run out
+void uring_prep_recv_multishot(struct io_uring_sqe *sqe, int fd);
+void uring_prep_sendmsg(struct io_uring_sqe *sqe, int fd, const struct msghdr *msg, int flags);
+void uring_prep_send(struct io_uring_sqe *sqe, int fd, const void *data, size_t length, int flags);
+void uring_prep_read(struct io_uring_sqe *sqe, int fd, void *data, size_t length, off_t offset);
+void uring_prep_poll(struct io_uring_sqe *sqe, int fd, unsigned events);
+// Cancels the operation submitted with user_data
+void uring_prep_cancel(struct io_uring_sqe *sqe, unsigned long long user_data);
+
+#endif //URING_H